@@ -73,10 +73,12 @@ auto *findPyBlock(PyBasicBlock *blocks, unsigned block_num, unsigned offset) {
 
 void CompileUnit::parseCFG() {
     auto py_instr_num = PyBytes_GET_SIZE(py_code->co_code) / sizeof(_Py_CODEUNIT);
-    vpc_to_stack_height.reserve(py_instr_num);
-    redundant_loads.reserve(py_instr_num, false);
+    vpc_to_stack_height.reserve(arena, py_instr_num);
+    lasti_observed.reserve(arena, py_instr_num, false);
+    redundant_loads.reserve(arena, py_instr_num, false);
+    deferred_formats.reserve(arena, py_instr_num, false);
 
-    BitArray is_boundary(py_instr_num + 1);
+    BitArray is_boundary(arena, py_instr_num + 1);
     handler_num = 1;
     block_num = 0;
     try_block_num = 0;
@@ -105,7 +107,7 @@ void CompileUnit::parseCFG() {
     block_num -= is_boundary.get(0);
     is_boundary.reset(0);
 
-    blocks.reserve(block_num + try_block_num);
+    blocks.reserve(arena, block_num + try_block_num);
 
     unsigned created_block_num = 0;
     unsigned start_index = 0;
@@ -145,16 +147,16 @@ void CompileUnit::parseCFG() {
     auto nlocals = py_code->co_nlocals;
     auto exception_block_index = block_num;
     for (auto &b : PtrRange(blocks.getPointer(), block_num)) {
-        b.locals_kept.reserve(nlocals, false);
-        b.locals_set.reserve(nlocals, false);
-        b.locals_ever_deleted.reserve(nlocals, false);
+        b.locals_kept.reserve(arena, nlocals, false);
+        b.locals_set.reserve(arena, nlocals, false);
+        b.locals_ever_deleted.reserve(arena, nlocals, false);
         if (b._branch_offset != py_instr_num) {
             auto branch_block = findPyBlock(blocks.getPointer(), block_num, b._branch_offset);
             if (b.eh_body_enter) {
                 auto &eb = *(b.branch = &blocks[exception_block_index++]);
-                eb.locals_kept.reserve(nlocals, true);
-                eb.locals_set.reserve(nlocals, false);
-                eb.locals_ever_deleted.reserve(nlocals, false);
+                eb.locals_kept.reserve(arena, nlocals, true);
+                eb.locals_set.reserve(arena, nlocals, false);
+                eb.locals_ever_deleted.reserve(arena, nlocals, false);
                 eb.branch = branch_block;
                 eb.eh_setup_block = &b;
             } else {
@@ -170,6 +172,7 @@ void CompileUnit::parseCFG() {
 template <typename T>
 class ReversedStack {
     ssize_t size;
+    DynamicArray<T> storage;
     T *const stack;
     T *sp;
     T until_now;
@@ -177,9 +180,7 @@ public:
 
     static constexpr auto until_forever = numeric_limits<T>::max();
 
-    explicit ReversedStack(ssize_t size) : size{size}, stack{new T[size * 2]} { reset(); }
-
-    ~ReversedStack() noexcept { delete[] stack; }
+    ReversedStack(BumpArena &arena, ssize_t size) : size{size}, storage(arena, size * 2), stack{storage.getPointer()} { reset(); }
 
     void setTimestamp(T t) { until_now = t; }
 
@@ -214,6 +215,13 @@ public:
         }
     }
 
+    // the values below the top n are used only after a suspension, so they must stay in the frame as they are
+    void pin_below(int n) {
+        for (auto p = stack; p < sp - n; p++) {
+            *p = until_forever;
+        }
+    }
+
     T push() {
         return *--sp;
     }
@@ -221,13 +229,13 @@ public:
 
 
 void CompileUnit::doIntraBlockAnalysis() {
-    ReversedStack<unsigned> stack(py_code->co_stacksize);
+    ReversedStack<unsigned> stack(arena, py_code->co_stacksize);
 
     const PyInstrPointer py_instr{py_code};
     unsigned code_instr_num = blocks[block_num - 1].end_index;
     constexpr unsigned until_anytime = 0;
 
-    DynamicArray<unsigned> locals(py_code->co_nlocals);
+    DynamicArray<unsigned> locals(arena, py_code->co_nlocals);
     for (auto i : IntRange(py_code->co_nlocals)) {
         locals[i] = code_instr_num;
     }
@@ -501,6 +509,9 @@ void CompileUnit::doIntraBlockAnalysis() {
             break;
 
         case BUILD_STRING:
+            stack.push();
+            stack.pop_n_consecutively(instr.oparg(py_instr), vpc);
+            break;
         case BUILD_TUPLE:
         case BUILD_LIST:
         case BUILD_SET:
@@ -534,13 +545,18 @@ void CompileUnit::doIntraBlockAnalysis() {
             stack.pop();
             break;
 
-        case FORMAT_VALUE:
-            stack.push();
+        case FORMAT_VALUE: {
+            auto oparg = instr.oparg(py_instr);
+            auto consumer = stack.push();
+            // format(v, '') is str(v) for exact int and float, which BUILD_STRING can do by itself
+            deferred_formats.setIf(vpc, (oparg & FVS_MASK) != FVS_HAVE_SPEC && (oparg & FVC_MASK) <= FVC_STR &&
+                    consumer < code_instr_num && (py_instr + consumer).opcode() == BUILD_STRING);
             stack.pop();
-            if ((instr.oparg(py_instr) & FVS_MASK) == FVS_HAVE_SPEC) {
+            if ((oparg & FVS_MASK) == FVS_HAVE_SPEC) {
                 stack.pop();
             }
             break;
+        }
         case BUILD_SLICE:
             stack.push();
             stack.pop();
@@ -643,6 +659,8 @@ void CompileUnit::doIntraBlockAnalysis() {
         case YIELD_VALUE:
             stack.push();
             stack.pop();
+            // the interpreter may resume the frame, which neither reloads borrowed values nor renders deferred ones
+            stack.pin_below(1);
             break;
         case GET_YIELD_FROM_ITER:
             stack.push();
@@ -652,6 +670,7 @@ void CompileUnit::doIntraBlockAnalysis() {
             stack.push();
             stack.pop();
             stack.pop(stack.until_forever);
+            stack.pin_below(1);
             break;
         case GET_AWAITABLE:
             stack.push();
@@ -682,34 +701,9 @@ void CompileUnit::doIntraBlockAnalysis() {
     }
 }
 
-void analyzeEHBlock(PyBasicBlock &eb, unsigned nlocals, unsigned nesting_depth, PyBasicBlock &b) {
-    if (b.visited_eh_block == &eb) {
-        return;
-    }
-    b.visited_eh_block = &eb;
-    for (auto [kept, deleted] : BitArrayChunks(nlocals, eb.locals_kept, b.locals_ever_deleted)) {
-        kept &= ~deleted;
-    }
-    if (b.branch) {
-        auto branch_block = b.eh_body_enter ? b.branch->branch : b.branch;
-        analyzeEHBlock(eb, nlocals, nesting_depth, *branch_block);
-    }
-    nesting_depth = nesting_depth + b.eh_body_enter - b.eh_body_exit;
-    if (b.fall_through && nesting_depth) {
-        if (nesting_depth >= CO_MAXBLOCKS - 1) {
-            throw runtime_error("too much nesting blocks");
-        }
-        analyzeEHBlock(eb, nlocals, nesting_depth, b.next());
-    }
-}
-
 void CompileUnit::doInterBlockAnalysis() {
     const auto nlocals = py_code->co_nlocals;
 
-    for (auto &eb : PtrRange(blocks.getPointer(block_num), try_block_num)) {
-        analyzeEHBlock(eb, nlocals, 1, eb.eh_setup_block->next());
-    }
-
     PyBasicBlock *worklist_head = nullptr;
     auto &first_block = blocks[0];
     for (auto b = blocks.getPointer(block_num + try_block_num); b-- != &first_block;) {
@@ -724,7 +718,7 @@ void CompileUnit::doInterBlockAnalysis() {
         nargs = nargs > BitArray::bits_per_chunk ? nargs - BitArray::bits_per_chunk : 0;
     }
 
-    BitArray block_output(nlocals);
+    BitArray block_output(arena, nlocals);
 
     do {
         auto &b = *worklist_head;
@@ -781,6 +775,15 @@ void CompileUnit::doInterBlockAnalysis() {
         }
     } while (worklist_head);
 
+    for (auto &eb : PtrRange(blocks.getPointer(block_num), try_block_num)) {
+        if (eb.try_region >= 0) {
+            // the handler starts with the 6 values pushed by unwinding above the level
+            auto level = eb.branch->initial_stack_height - 6;
+            try_regions[eb.try_region].level = level;
+            try_regions[eb.try_region + 1].level = level;
+        }
+    }
+
     // for (auto i : IntRange(nlocals)) {
     //     fprintf(stderr, "\t%s", PyUnicode_AsUTF8(PyTuple_GET_ITEM(py_code->co_varnames, i)));
     // }
@@ -794,3 +797,134 @@ void CompileUnit::doInterBlockAnalysis() {
     // }
     // fprintf(stderr, "\n");
 }
+
+void CompileUnit::analyzeTryRegions() {
+    constexpr int unvisited = -2;
+    const PyInstrPointer py_instr{py_code};
+    auto code_instr_num = blocks[block_num - 1].end_index;
+    vpc_to_try_region.reserve(arena, code_instr_num);
+    for (auto vpc : IntRange(code_instr_num)) {
+        vpc_to_try_region[vpc] = -1;
+    }
+    // each try block has a region for its body and another for its handler
+    try_regions.reserve(2 * try_block_num);
+    int region_num = 0;
+
+    for (auto &b : PtrRange(blocks.getPointer(), block_num + try_block_num)) {
+        b.try_region = unvisited;
+    }
+    DynamicArray<PyBasicBlock *> body_owners(arena, try_block_num);
+    LimitedStack<PyBasicBlock *> worklist;
+    worklist.reserve(arena, block_num);
+    blocks[0].try_region = -1;
+    worklist.push(&blocks[0]);
+
+    auto visit = [&](PyBasicBlock &successor, int region) {
+        if (successor.try_region == unvisited) {
+            successor.try_region = region;
+            worklist.push(&successor);
+        } else {
+            assert(successor.try_region == region);
+        }
+    };
+
+    while (!worklist.empty()) {
+        auto &b = *worklist.pop();
+        auto region = b.try_region;
+        auto start_index = &b == blocks.getPointer() ? 0 : (&b)[-1].end_index;
+        for (auto vpc : IntRange(start_index, b.end_index)) {
+            vpc_to_try_region[vpc] = region;
+            auto opcode = (py_instr + vpc).opcode();
+            if (opcode == POP_BLOCK || opcode == POP_EXCEPT || opcode == END_ASYNC_FOR) {
+                assert(region >= 0);
+                region = try_regions[region].parent;
+            }
+        }
+        if (b.eh_body_enter) {
+            // b.branch is still the exception entry here, the level is filled by doInterBlockAnalysis
+            auto &eb = *b.branch;
+            auto body_region = region_num++;
+            auto handler_region = region_num++;
+            auto handler_vpc = static_cast<int>(eb.branch[-1].end_index);
+            try_regions[body_region] = {region, -1, 0, handler_vpc};
+            try_regions[handler_region] = {region, -1, -1, -1};
+            eb.try_region = body_region;
+            body_owners[body_region / 2] = &eb;
+            visit(*eb.branch, handler_region);
+            visit(b.next(), body_region);
+        } else {
+            if (b.branch) {
+                visit(*b.branch, region);
+            }
+            if (b.fall_through) {
+                visit(b.next(), region);
+            }
+        }
+    }
+
+    // a local is still bound when entering a handler only if no block of the try body deletes it
+    auto nlocals = py_code->co_nlocals;
+    auto enclosing_body = [&](int region) {
+        while (region >= 0 && try_regions[region].handler < 0) {
+            region = try_regions[region].parent;
+        }
+        return region;
+    };
+    for (auto &b : PtrRange(blocks.getPointer(), block_num)) {
+        if (b.try_region != unvisited) {
+            auto body = enclosing_body(b.try_region);
+            if (body >= 0) {
+                for (auto [kept, deleted] : BitArrayChunks(nlocals,
+                        body_owners[body / 2]->locals_kept, b.locals_ever_deleted)) {
+                    kept &= ~deleted;
+                }
+            }
+        }
+    }
+    // a region is numbered after its parent, so the inner bodies are merged before being merged outward
+    for (auto body = region_num - 2; body >= 0; body -= 2) {
+        auto outer = enclosing_body(try_regions[body].parent);
+        if (outer >= 0) {
+            for (auto [outer_kept, inner_kept] : BitArrayChunks(nlocals,
+                    body_owners[outer / 2]->locals_kept, body_owners[body / 2]->locals_kept)) {
+                outer_kept &= inner_kept;
+            }
+        }
+    }
+}
+
+void CompileUnit::selectLoopRegions() {
+    // the code leading to the first loop and the first loop nest are compiled, the interpreter running the code after
+    // them can come back only at a FOR_ITER header, so a later loop nest is compiled only if it starts with one
+    auto first_header = block_num;
+    DynamicArray<int> nesting_delta(arena, block_num + 1);
+    for (auto i : IntRange(block_num + 1)) {
+        nesting_delta[i] = 0;
+    }
+    for (auto i : IntRange(block_num)) {
+        auto &b = blocks[i];
+        if (b.branch && !b.eh_body_enter && b.branch <= &b) {
+            unsigned header = b.branch - blocks.getPointer();
+            first_header = min(first_header, header);
+            nesting_delta[header]++;
+            nesting_delta[i + 1]--;
+        }
+    }
+    // a suspended generator that left the compiled code stays in the interpreter
+    bool can_reenter = !(py_code->co_flags & (CO_GENERATOR | CO_COROUTINE | CO_ASYNC_GENERATOR));
+    const PyInstrPointer py_instr{py_code};
+    int nesting = 0;
+    bool is_compiled_nest = false;
+    for (auto i : IntRange(block_num)) {
+        if (!nesting && nesting_delta[i]) {
+            auto vpc = i ? blocks[i - 1].end_index : 0;
+            while ((py_instr + vpc).opcode() == EXTENDED_ARG) {
+                vpc++;
+            }
+            blocks[i].interpreter_entry = i != first_header && can_reenter && (py_instr + vpc).opcode() == FOR_ITER;
+            is_compiled_nest = i == first_header || blocks[i].interpreter_entry;
+        }
+        nesting += nesting_delta[i];
+        blocks[i].interpreted = i >= first_header && !(nesting && is_compiled_nest);
+    }
+}
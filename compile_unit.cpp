@@ -1,5 +1,12 @@
+#include <bit>
+#include <chrono>
+
 #include <Python.h>
 
+#undef HAVE_STD_ATOMIC
+
+#include <internal/pycore_interp.h>
+
 #include "compile_unit.h"
 
 
@@ -22,22 +29,91 @@ void DebugInfoBuilder::setLocation(llvm::IRBuilder<> &ir_builder, int vpc) {
 }
 
 
-void CompileUnit::translate() {
+// the instructions whose fast paths are chosen by the operand types
+static bool recordsOperandTypes(int opcode) {
+    switch (opcode) {
+    case BINARY_SUBSCR:
+    case COMPARE_OP:
+    case BINARY_ADD:
+    case INPLACE_ADD:
+    case BINARY_SUBTRACT:
+    case INPLACE_SUBTRACT:
+    case BINARY_MULTIPLY:
+    case INPLACE_MULTIPLY:
+    case BINARY_FLOOR_DIVIDE:
+    case INPLACE_FLOOR_DIVIDE:
+    case BINARY_TRUE_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+    case BINARY_MODULO:
+    case INPLACE_MODULO:
+    case BINARY_POWER:
+    case INPLACE_POWER:
+    case BINARY_MATRIX_MULTIPLY:
+    case INPLACE_MATRIX_MULTIPLY:
+    case BINARY_LSHIFT:
+    case INPLACE_LSHIFT:
+    case BINARY_RSHIFT:
+    case INPLACE_RSHIFT:
+    case BINARY_AND:
+    case INPLACE_AND:
+    case BINARY_OR:
+    case INPLACE_OR:
+    case BINARY_XOR:
+    case INPLACE_XOR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void CompileUnit::translate(bool loops_only, bool profiling) {
     function = Function::Create(context.type<CompiledFunction>(),
             Function::ExternalLinkage, "the_function", &llvm_module);
     function->setAttributes(context.attr_default_call);
+    // the code is copied out without relocation, so no jump table or lookup table in rodata
+    function->addFnAttr("no-jump-tables", "true");
     di_builder.setFunction(builder, py_code, function);
 
     (shared_symbols = function->getArg(0))->setName(useName("symbols"));
     (frame_obj = function->getArg(1))->setName(useName("frame"));
     // TODO: 下面的，不知是否有必要
     shared_symbols->addAttr(Attribute::NoAlias);
-    frame_obj->addAttr(Attribute::NoAlias);
+    // the frame is not noalias, the helpers reach it through tstate->frame as well
 
     // TODO: 重复了
     parseCFG();
     doIntraBlockAnalysis();
+    analyzeTryRegions();
     doInterBlockAnalysis();
+    if (loops_only) {
+        selectLoopRegions();
+    }
+    for (auto &b : PtrRange(blocks.getPointer(), block_num)) {
+        if (b.branch && !b.eh_body_enter && b.branch <= &b) {
+            b.branch->loop_header = true;
+        }
+    }
+    if (profiling) {
+        auto instr_num = blocks[block_num - 1].end_index;
+        const PyInstrPointer py_instr{py_code};
+        unsigned type_site_num = 0;
+        for (auto vpc : IntRange(instr_num)) {
+            type_site_num += recordsOperandTypes((py_instr + vpc).opcode());
+        }
+        profile = make_unique<BlockProfile>(block_num, instr_num, type_site_num);
+        for (auto i : IntRange(block_num)) {
+            profile->block_ends[i] = blocks[i].end_index;
+        }
+        type_site_num = 0;
+        for (auto vpc : IntRange(instr_num)) {
+            if (recordsOperandTypes((py_instr + vpc).opcode())) {
+                profile->type_sites[type_site_num++] = vpc;
+            }
+        }
+    }
+    if (feedback && feedback->block_num != block_num) {
+        feedback = nullptr;
+    }
 
     entry_block = createBlock(useName("entry_block"));
     entry_block->insertInto(function);
@@ -50,7 +126,7 @@ void CompileUnit::translate() {
     auto num_of_locals = py_code->co_nlocals;
     auto num_of_frees = PyTuple_GET_SIZE(py_code->co_cellvars) + PyTuple_GET_SIZE(py_code->co_freevars);
     auto num_of_stack_values = py_code->co_stacksize;
-    value_pointers.reserve(num_of_names + num_of_consts + num_of_locals + num_of_frees + num_of_stack_values);
+    value_pointers.reserve(arena, num_of_names + num_of_consts + num_of_locals + num_of_frees + num_of_stack_values);
 
     name_slots = value_pointers.getPointer(0);
     auto rt_code_names_items = getPointer(
@@ -98,27 +174,35 @@ void CompileUnit::translate() {
             sizeof(PyTryBlock) * (CO_MAXBLOCKS - 1) +
             offsetof(PyTryBlock, b_handler);
     coroutine_handler = getPointer<char>(frame_obj, offset, "coroutine_handler");
-    entry_jump = builder.CreateIndirectBr(builder.CreateInBoundsGEP(
-            context.type<char>(), BlockAddress::get(function, blocks[0]),
-            loadValue<int>(coroutine_handler, context.tbaa_frame_value, "jump_to_offset")
-    ), handler_num);
-    entry_jump->addDestination(blocks[0]);
+    // the flag belongs to the interpreter, which is the same as long as the code lives
+    auto eval_breaker_address = &PyInterpreterState_Get()->ceval.eval_breaker._value;
+    eval_breaker = asPointer(eval_breaker_address, useName("eval_breaker"));
+    if (profile) {
+        // the counters are owned by the TranslatedResult, so their address is fixed as well
+        profile_counts = asPointer(profile->counts.getPointer(), useName("profile_counts"));
+    }
+    // resume id 0 is the start of the code, the others are registered by addResumePoint
+    entry_jump = builder.CreateSwitch(loadValue<int>(coroutine_handler, context.tbaa_frame_value, "resume_id"),
+            blocks[0], handler_num);
 
-    error_block = createBlock("raise_error");
+    error_block = nullptr;
+    interpreter_entry_block = getInterpreterEntryBlock();
 
-    abstract_stack.reserve(py_code->co_stacksize);
+    abstract_stack.reserve(arena, py_code->co_stacksize);
     for (auto &b : PtrRange(blocks.getPointer(), block_num)) {
         abstract_stack_height = stack_height = 0;
         b.block->insertInto(function);
         builder.SetInsertPoint(b);
-        emitBlock(b);
+        if (profile) {
+            emitCounterIncrement(profile_counts, &b - blocks.getPointer());
+        }
+        if (b.interpreted) {
+            emitInterpreterExit(b);
+        } else {
+            emitBlock(b);
+        }
     }
 
-    error_block->insertInto(function);
-    builder.SetInsertPoint(error_block);
-    callSymbol<raiseException, &Context::attr_noreturn>();
-    builder.CreateUnreachable();
-
     di_builder.finalize();
 }
 
@@ -192,6 +276,14 @@ CompileUnit::FetchedStackValue CompileUnit::fetchStackValue(int i) {
     return FetchedStackValue{abstract_stack[abstract_stack_height - i]};
 }
 
+PyObject *CompileUnit::fetchStackConstant(int i) {
+    auto &v = abstract_stack[abstract_stack_height - i];
+    if (v.really_pushed || v.is_local) {
+        return nullptr;
+    }
+    return PyTuple_GET_ITEM(py_code->co_consts, v.index);
+}
+
 CompileUnit::PoppedStackValue CompileUnit::do_POP() {
     auto v = abstract_stack[--abstract_stack_height];
     stack_height -= v.really_pushed;
@@ -279,29 +371,91 @@ llvm::Value *CompileUnit::getSymbol(size_t offset) {
     return loadValue<void *>(ptr, context.tbaa_symbols, useName("sym.", name, "."));
 }
 
+void CompileUnit::syncLasti() {
+    lasti_observed.set(emitting_vpc);
+    storeValue<decltype(PyFrameObject::f_lasti)>(asValue<decltype(PyFrameObject::f_lasti)>(emitting_vpc),
+            rt_lasti, context.tbaa_frame_value);
+}
+
+void CompileUnit::emitEvalBreakerCheck() {
+    // an atomic load, otherwise it would be hoisted out of the loop
+    auto flag = builder.CreateAlignedLoad(context.type<int>(), eval_breaker, Align{alignof(int)});
+    flag->setAtomic(AtomicOrdering::Monotonic);
+    auto b_handle = appendBlock("eval_breaker");
+    auto b_end = appendBlock("eval_breaker.end");
+    builder.CreateCondBr(builder.CreateICmpEQ(flag, asValue(0)), b_end, b_handle, context.likely_true);
+    builder.SetInsertPoint(b_handle);
+    callSymbol<handleEvalBreaker>();
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_end);
+}
+
+BasicBlock *CompileUnit::getErrorBlock() {
+    // one per instruction, raiseException sets f_lasti itself
+    if (!error_block || error_block_vpc != emitting_vpc) {
+        error_block_vpc = emitting_vpc;
+        lasti_observed.set(emitting_vpc);
+        error_block = appendBlock("raise_error");
+        IRBuilderBase::InsertPointGuard guard{builder};
+        builder.SetInsertPoint(error_block);
+        callSymbol<raiseException, &Context::attr_noreturn>(asValue<int>(emitting_vpc));
+        builder.CreateUnreachable();
+    }
+    return error_block;
+}
+
+void CompileUnit::emitCounterIncrement(Value *counters, size_t index) {
+    auto ptr = getPointer<unsigned long long>(counters, index);
+    auto count = loadValue<unsigned long long>(ptr, context.tbaa_counter);
+    storeValue<unsigned long long>(builder.CreateAdd(count, asValue(1ULL)), ptr, context.tbaa_counter);
+}
+
+bool CompileUnit::isFollowedByPopJump(PyBasicBlock &current, unsigned vpc) {
+    const PyInstrPointer py_instr{py_code};
+    while ((py_instr + ++vpc).opcode() == EXTENDED_ARG) {
+    }
+    if (vpc + 1 != current.end_index) {
+        return false;
+    }
+    auto opcode = (py_instr + vpc).opcode();
+    return opcode == POP_JUMP_IF_FALSE || opcode == POP_JUMP_IF_TRUE;
+}
+
 void CompileUnit::pyJumpIF(PyBasicBlock &current, bool pop_if_jump, bool jump_cond) {
+    auto branch_block = jumpTarget(current);
+    auto weights = branchWeights(current, jump_cond);
+    if (fused_condition) {
+        assert(pop_if_jump);
+        BasicBlock *jump_block = branch_block;
+        BasicBlock *fall_block = current.next();
+        builder.CreateCondBr(fused_condition, jump_cond ? jump_block : fall_block,
+                jump_cond ? fall_block : jump_block, weights);
+        fused_condition = nullptr;
+        return;
+    }
+
     auto cond_obj = do_POP();
 
     auto fall_block = cond_obj.really_pushed ? appendBlock("") : current.next();
-    auto jump_block = cond_obj.really_pushed && pop_if_jump ? appendBlock("") : *current.branch;
+    auto jump_block = cond_obj.really_pushed && pop_if_jump ? appendBlock("") : branch_block;
     auto fast_cmp_block = appendBlock("");
     auto slow_cmp_block = appendBlock("");
     auto true_block = jump_cond ? jump_block : fall_block;
     auto false_block = jump_cond ? fall_block : jump_block;
 
     auto py_true = getSymbol(searchSymbol<_Py_TrueStruct>());
-    builder.CreateCondBr(builder.CreateICmpEQ(cond_obj, py_true), true_block, fast_cmp_block);
+    builder.CreateCondBr(builder.CreateICmpEQ(cond_obj, py_true), true_block, fast_cmp_block, weights);
     builder.SetInsertPoint(fast_cmp_block);
     auto py_false = getSymbol(searchSymbol<_Py_FalseStruct>());
     builder.CreateCondBr(builder.CreateICmpEQ(cond_obj, py_false), false_block, slow_cmp_block, context.likely_true);
     builder.SetInsertPoint(slow_cmp_block);
-    builder.CreateCondBr(callSymbol<castPyObjectToBool>(cond_obj), true_block, false_block);
+    builder.CreateCondBr(callSymbol<castPyObjectToBool>(cond_obj), true_block, false_block, weights);
 
     if (cond_obj.really_pushed) {
         if (pop_if_jump) {
             builder.SetInsertPoint(jump_block);
             do_Py_DECREF(cond_obj);
-            builder.CreateBr(*current.branch);
+            builder.CreateBr(branch_block);
         }
         builder.SetInsertPoint(fall_block);
         do_Py_DECREF(cond_obj);
@@ -309,6 +463,172 @@ void CompileUnit::pyJumpIF(PyBasicBlock &current, bool pop_if_jump, bool jump_co
     }
 }
 
+BasicBlock *CompileUnit::jumpTarget(PyBasicBlock &current) {
+    if (!profile) {
+        return *current.branch;
+    }
+    // a taken conditional jump goes through a block counting it, the fall through is the rest of the executions
+    auto block_index = &current - blocks.getPointer();
+    profile->conditional_ends.set(block_index);
+    auto insert_point = builder.saveIP();
+    auto b_taken = appendBlock("jump_taken");
+    builder.SetInsertPoint(b_taken);
+    emitCounterIncrement(profile_counts, profile->jumpIndex(block_index));
+    builder.CreateBr(*current.branch);
+    builder.restoreIP(insert_point);
+    return b_taken;
+}
+
+MDNode *CompileUnit::branchWeights(PyBasicBlock &current, bool jump_if_true) {
+    auto block_index = &current - blocks.getPointer();
+    if (!feedback || !feedback->conditional_ends.get(block_index)) {
+        return nullptr;
+    }
+    auto executed = feedback->counts[block_index];
+    if (!executed) {
+        return nullptr;
+    }
+    // a block left by an exception counts as executed without taking either way
+    auto taken = min(feedback->counts[feedback->jumpIndex(block_index)], executed);
+    auto shift = max<int>(bit_width(executed), 32) - 32;
+    auto jump_weight = static_cast<uint32_t>(taken >> shift);
+    auto fall_weight = static_cast<uint32_t>((executed - taken) >> shift);
+    return MDBuilder(context.llvm_context).createBranchWeights(jump_if_true ? jump_weight : fall_weight,
+            jump_if_true ? fall_weight : jump_weight);
+}
+
+void CompileUnit::recordOperandTypes(Value *left, Value *right) {
+    if (!profile) {
+        return;
+    }
+    auto site = profile->typeSiteIndex(emitting_vpc);
+    assert(site >= 0);
+    auto seen = &profile->observed_types[site];
+    auto seen_ptr = asPointer(seen);
+    auto left_type = loadFieldValue(left, &PyObject::ob_type, context.tbaa_obj_field);
+    auto right_type = loadFieldValue(right, &PyObject::ob_type, context.tbaa_obj_field);
+    auto seen_left = loadFieldValue(seen_ptr, &ObservedTypes::left, context.tbaa_counter);
+    auto seen_right = loadFieldValue(seen_ptr, &ObservedTypes::right, context.tbaa_counter);
+    auto is_same = builder.CreateAnd(builder.CreateICmpEQ(left_type, seen_left),
+            builder.CreateICmpEQ(right_type, seen_right));
+    auto b_record = appendBlock("record_types");
+    auto b_end = appendBlock("record_types.end");
+    builder.CreateCondBr(is_same, b_end, b_record, context.likely_true);
+    builder.SetInsertPoint(b_record);
+    // no helper call of the instruction, so not counted through callSymbol
+    callFunction(context.type<remove_reference_t<decltype(recordTypes)>>(), getSymbol(searchSymbol<recordTypes>()),
+            seen_ptr, left_type, right_type);
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_end);
+}
+
+const ObservedTypes *CompileUnit::monomorphicTypes() {
+    if (!feedback) {
+        return nullptr;
+    }
+    auto site = feedback->typeSiteIndex(emitting_vpc);
+    if (site < 0) {
+        return nullptr;
+    }
+    // a site which never ran or saw several pairs keeps all the generic paths
+    auto &seen = feedback->observed_types[site];
+    return seen.left && !seen.polymorphic ? &seen : nullptr;
+}
+
+void CompileUnit::emitInterpreterExit(PyBasicBlock &this_block) {
+    // the stack values live in the frame at block boundaries, so the interpreter can take over from here
+    auto start_index = &this_block == blocks.getPointer() ? 0 : (&this_block)[-1].end_index;
+    di_builder.setLocation(builder, start_index);
+    emitting_vpc = start_index;
+    auto result = callSymbol<resumeInInterpreter>(frame_obj,
+            asValue<int>(start_index), asValue<int>(this_block.initial_stack_height));
+    if (!interpreter_entry_block) {
+        builder.CreateRet(result);
+        return;
+    }
+    if (this_block.eh_body_enter) {
+        // the try body can be a later loop nest which the interpreter enters after setting up the try block
+        registerTryHandler(this_block);
+    }
+    // the frame is still executing when the interpreter stopped at the header of a later loop nest
+    auto state = loadFieldValue(frame_obj, &PyFrameObject::f_state, context.tbaa_obj_field);
+    auto b_return = appendBlock("interpreter_exit.return");
+    builder.CreateCondBr(builder.CreateICmpEQ(state, asValue<PyFrameState>(FRAME_EXECUTING)),
+            interpreter_entry_block, b_return);
+    builder.SetInsertPoint(b_return);
+    builder.CreateRet(result);
+}
+
+// the FOR_ITER of a loop header, after the EXTENDED_ARGs starting the block
+static int headerIndex(PyCodeObject *py_code, int start_index) {
+    const PyInstrPointer py_instr{py_code};
+    while ((py_instr + start_index).opcode() == EXTENDED_ARG) {
+        start_index++;
+    }
+    return start_index;
+}
+
+BasicBlock *CompileUnit::getInterpreterEntryBlock() {
+    auto blocks_begin = blocks.getPointer();
+    if (none_of(blocks_begin, blocks_begin + block_num, [](auto &b) { return b.interpreter_entry; })) {
+        return nullptr;
+    }
+    auto b_entry = appendBlock("interpreter_entry");
+    auto b_unreachable = appendBlock("interpreter_entry.unreachable");
+    IRBuilderBase::InsertPointGuard guard{builder};
+    builder.SetInsertPoint(b_unreachable);
+    builder.CreateUnreachable();
+    builder.SetInsertPoint(b_entry);
+    // f_lasti is the YIELD_VALUE the interpreter stopped at
+    auto lasti = loadFieldValue(frame_obj, &PyFrameObject::f_lasti, context.tbaa_frame_value);
+    auto dispatch = builder.CreateSwitch(lasti, b_unreachable);
+    for (auto &b : PtrRange(blocks.getPointer(), block_num)) {
+        if (b.interpreter_entry) {
+            auto start_index = &b == blocks.getPointer() ? 0 : (&b)[-1].end_index;
+            auto header = asValue<decltype(PyFrameObject::f_lasti)>(headerIndex(py_code, start_index));
+            dispatch->addCase(cast<ConstantInt>(header), b);
+        }
+    }
+    return b_entry;
+}
+
+PyObject *CompileUnit::copyCodeWithInterpreterExits() {
+    // a YIELD_VALUE in place of each FOR_ITER header takes the iterator and returns from the interpreter
+    PyObjectRef code_bytes{PyBytes_FromStringAndSize(PyBytes_AS_STRING(py_code->co_code),
+            PyBytes_GET_SIZE(py_code->co_code))};
+    auto instrs = reinterpret_cast<unsigned char *>(PyBytes_AS_STRING(code_bytes.o));
+    for (auto &b : PtrRange(blocks.getPointer(), block_num)) {
+        if (b.interpreter_entry) {
+            auto start_index = &b == blocks.getPointer() ? 0 : (&b)[-1].end_index;
+            auto instr = instrs + headerIndex(py_code, start_index) * sizeof(_Py_CODEUNIT);
+            instr[0] = YIELD_VALUE;
+            instr[1] = 0;
+        }
+    }
+    auto copy = PyCode_NewWithPosOnlyArgs(py_code->co_argcount, py_code->co_posonlyargcount,
+            py_code->co_kwonlyargcount, py_code->co_nlocals, py_code->co_stacksize, py_code->co_flags, code_bytes,
+            py_code->co_consts, py_code->co_names, py_code->co_varnames, py_code->co_freevars,
+            py_code->co_cellvars, py_code->co_filename, py_code->co_name, py_code->co_firstlineno,
+            py_code->co_linetable);
+    if (!copy) {
+        throw bad_exception();
+    }
+    return reinterpret_cast<PyObject *>(copy);
+}
+
+int CompileUnit::addResumePoint(BasicBlock *block) {
+    int id = entry_jump->getNumCases() + 1;
+    entry_jump->addCase(cast<ConstantInt>(asValue(id)), block);
+    return id;
+}
+
+void CompileUnit::registerTryHandler(PyBasicBlock &setup_block) {
+    // skip the unreachable ones, which analyzeTryRegions never visits
+    if (setup_block.try_region >= -1) {
+        try_regions[setup_block.next().try_region].handler = addResumePoint(*setup_block.branch);
+    }
+}
+
 // TODO: 直接加载不好，最好延迟
 void CompileUnit::declareStackGrowth(int n) {
     for ([[maybe_unused]]auto i : IntRange(n)) {
@@ -343,15 +663,41 @@ void CompileUnit::refreshAbstractStack() {
 
 static void notifyCodeLoaded(PyObject * py_code, void * code_addr) {}
 
-CompileUnit::TranslatedResult *CompileUnit::emit(Translator &translator, PyObject *py_code) {
+// a range starts only where the value changes, the vpcs that are never looked up are skipped
+static auto compressVpcMap(const auto &values, unsigned instr_num, const auto &is_looked_up) {
+    auto visit = [&](auto &&add_range) {
+        bool first = true;
+        int last;
+        for (auto vpc : IntRange(instr_num)) {
+            if (is_looked_up(vpc) && (first || values[vpc] != last)) {
+                // lookups before the first range fall into it
+                add_range(first ? 0 : vpc, values[vpc]);
+                first = false;
+                last = values[vpc];
+            }
+        }
+    };
+    int range_num = 0;
+    visit([&](int, int) { ++range_num; });
+    DynamicArray<VpcRange> ranges(range_num);
+    int i = 0;
+    visit([&](int vpc, int value) { ranges[i++] = {vpc, value}; });
+    return make_pair(move(ranges), range_num);
+}
+
+CompileUnit::TranslatedResult *CompileUnit::emit(Translator &translator, PyObject *py_code, bool loops_only,
+        bool profiling, const BlockProfile *feedback) {
     if constexpr (debug_build) {
         callDebugHelperFunction("dump_pydis", py_code);
     }
 
-    CompileUnit cu{translator};
+    BumpArena::Scope arena_scope{translator.arena};
+    CompileUnit cu{translator, translator.arena};
     cu.py_code = reinterpret_cast<PyCodeObject *>(py_code);
+    cu.count_helper_calls = jit_statistics.count_helper_calls;
+    cu.feedback = feedback;
     cu.llvm_module.setDataLayout(translator.machine->createDataLayout());
-    cu.translate();
+    cu.translate(loops_only, profiling);
 
     if constexpr (debug_build) {
         SmallVector<char> ll_vec{};
@@ -375,10 +721,65 @@ CompileUnit::TranslatedResult *CompileUnit::emit(Translator &translator, PyObjec
     }
     auto memory = loadCode(obj);
     obj.resize(0);
+    PyObject *interpreter_code = nullptr;
+    if (cu.interpreter_entry_block) {
+        try {
+            interpreter_code = cu.copyCodeWithInterpreterExits();
+        } catch (bad_exception &) {
+            unloadCode(memory);
+            throw;
+        }
+    }
     // TODO: cout capcity
     notifyCodeLoaded(py_code, memory.base());
 
-    return new CompileUnit::TranslatedResult{memory, move(cu.vpc_to_stack_height)};
+    auto instr_num = cu.blocks[cu.block_num - 1].end_index;
+    auto [sp_ranges, sp_range_num] = compressVpcMap(cu.vpc_to_stack_height, instr_num,
+            [&](unsigned vpc) { return cu.lasti_observed.get(vpc); });
+    auto [region_ranges, region_range_num] = compressVpcMap(cu.vpc_to_try_region, instr_num,
+            [](unsigned) { return true; });
+    auto metadata_bytes = sizeof(TranslatedResult) + (sp_range_num + region_range_num) * sizeof(VpcRange) +
+            cu.try_block_num * sizeof(TryRegion) + (cu.profile ? cu.profile->allocatedBytes() : 0) +
+            (interpreter_code ? sizeof(PyCodeObject) + PyBytes_GET_SIZE(cu.py_code->co_code) : 0);
+    auto result = new CompileUnit::TranslatedResult{memory, move(sp_ranges), sp_range_num, move(cu.try_regions),
+            move(region_ranges), region_range_num, memory.allocatedSize(), metadata_bytes, 0, loops_only,
+            cu.feedback != nullptr, 0, move(cu.profile)};
+    result->interpreter_code = interpreter_code;
+    return result;
+}
+
+CompileUnit::AnalysisStatistics CompileUnit::analyze(Translator &translator, PyObject *py_code) {
+    BumpArena::Scope arena_scope{translator.arena};
+    CompileUnit cu{translator, translator.arena};
+    cu.py_code = reinterpret_cast<PyCodeObject *>(py_code);
+
+    AnalysisStatistics stats{};
+    auto bytes_before = dynamic_array_allocated_bytes;
+    auto last = chrono::steady_clock::now();
+    auto lap = [&]() {
+        auto now = chrono::steady_clock::now();
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(now - last).count();
+        last = now;
+        return elapsed;
+    };
+    cu.parseCFG();
+    stats.parse_cfg = lap();
+    cu.doIntraBlockAnalysis();
+    stats.intra_block = lap();
+    cu.analyzeTryRegions();
+    stats.try_regions = lap();
+    cu.doInterBlockAnalysis();
+    stats.inter_block = lap();
+    stats.allocated_bytes = dynamic_array_allocated_bytes - bytes_before;
+    stats.instr_num = cu.blocks[cu.block_num - 1].end_index;
+    stats.block_num = cu.block_num;
+    stats.try_block_num = cu.try_block_num;
+
+    // the blocks are only inserted into a function by translate()
+    for (auto &b : PtrRange(cu.blocks.getPointer(), cu.block_num)) {
+        delete b.block;
+    }
+    return stats;
 }
 
 void CompileUnit::emitRotN(PyOparg n) {
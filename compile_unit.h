@@ -6,6 +6,7 @@
 #include <Python.h>
 #include <frameobject.h>
 #include <opcode.h>
+#include <longintrepr.h>
 
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/LLVMContext.h>
@@ -18,6 +19,7 @@
 #include "shared_symbols.h"
 #include "general_utilities.h"
 #include "translator.h"
+#include "jit_statistics.h"
 
 using PyOparg = decltype(_Py_OPCODE(std::declval<_Py_CODEUNIT>()));
 
@@ -66,16 +68,18 @@ struct PyBasicBlock {
         unsigned _branch_offset;
         PyBasicBlock *branch;
     };
-    union {
-        PyBasicBlock *visited_eh_block{nullptr};
-        PyBasicBlock *eh_setup_block;
-    };
+    PyBasicBlock *eh_setup_block{nullptr};
     int initial_stack_height;
     int stack_effect;
+    int try_region;
     int branch_stack_difference;
     bool fall_through{false};
     bool eh_body_enter{false};
     bool eh_body_exit{false};
+    bool interpreted{false};
+    bool loop_header{false};
+    // the header of a later loop nest, where the interpreter running the code before it comes back
+    bool interpreter_entry{false};
 
     PyBasicBlock() {};
     PyBasicBlock(const PyBasicBlock &) = delete;
@@ -114,10 +118,57 @@ public:
     void finalize() {}
 };
 
+// execution counts collected by code compiled with profiling
+struct BlockProfile {
+    unsigned block_num;
+    unsigned instr_num;
+    DynamicArray<unsigned> block_ends;
+    // the blocks ending with a conditional jump of the Python code
+    BitArray conditional_ends;
+    // the executions of each block, followed by the helper calls made by each instruction,
+    // followed by the jumps taken at the end of each block
+    DynamicArray<unsigned long long> counts;
+    // the instructions recording their operand types in ascending order, and what each has seen
+    unsigned type_site_num;
+    DynamicArray<unsigned> type_sites;
+    DynamicArray<ObservedTypes> observed_types;
+
+    BlockProfile(unsigned block_num, unsigned instr_num, unsigned type_site_num) :
+            block_num{block_num}, instr_num{instr_num}, block_ends(block_num), conditional_ends(block_num),
+            counts(2 * block_num + instr_num), type_site_num{type_site_num}, type_sites(type_site_num),
+            observed_types(type_site_num) {
+        std::fill_n(counts.getPointer(), 2 * block_num + instr_num, 0);
+        std::fill_n(observed_types.getPointer(), type_site_num, ObservedTypes{});
+    }
+
+    ~BlockProfile() {
+        for (auto &seen : PtrRange(observed_types.getPointer(), type_site_num)) {
+            Py_XDECREF(seen.left);
+            Py_XDECREF(seen.right);
+        }
+    }
+
+    auto jumpIndex(unsigned block) const { return block_num + instr_num + block; }
+
+    size_t allocatedBytes() const {
+        return sizeof(BlockProfile) + block_num * sizeof(unsigned) +
+                BitArray::chunkNumber(block_num) * sizeof(BitArray::ChunkType) +
+                (2 * block_num + instr_num) * sizeof(unsigned long long) +
+                type_site_num * (sizeof(unsigned) + sizeof(ObservedTypes));
+    }
+
+    int typeSiteIndex(unsigned vpc) const {
+        auto first = type_sites.getPointer();
+        auto site = std::lower_bound(first, first + type_site_num, vpc);
+        return site != first + type_site_num && *site == vpc ? site - first : -1;
+    }
+};
+
 #define PRELOAD
 
 class CompileUnit {
     Context &context;
+    BumpArena &arena;
     llvm::Module llvm_module{"the_module", context.llvm_context};
     llvm::IRBuilder<> builder{context.llvm_context};
     llvm::Function *function;
@@ -125,16 +176,31 @@ class CompileUnit {
     llvm::Argument *frame_obj;
     llvm::Value *rt_lasti;
     llvm::Value *coroutine_handler;
+    llvm::Value *eval_breaker;
     llvm::BasicBlock *entry_block;
     llvm::BasicBlock *error_block;
-    llvm::IndirectBrInst *entry_jump;
+    unsigned error_block_vpc;
+    llvm::BasicBlock *interpreter_entry_block{nullptr};
+    unsigned emitting_vpc{0};
+    llvm::SwitchInst *entry_jump;
 
     PyCodeObject *py_code;
+    bool count_helper_calls{false};
+    std::unique_ptr<BlockProfile> profile{};
+    llvm::Value *profile_counts;
+    // the profile of a previous compilation, which weights the branches of this one
+    const BlockProfile *feedback{};
     unsigned handler_num;
     unsigned block_num;
     unsigned try_block_num;
     DynamicArray<PyBasicBlock> blocks{};
     BitArray redundant_loads{};
+    BitArray deferred_formats{};
+    DynamicArray<int> vpc_to_try_region{};
+    // outlives the compilation in TranslatedResult, so it is not in the arena
+    DynamicArray<TryRegion> try_regions{};
+    // the vpcs whose f_lasti may be seen by the runtime, only these are kept in the compressed sp_map
+    BitArray lasti_observed{};
 
 #ifdef PRELOAD
     DynamicArray<llvm::Value *> value_pointers{};
@@ -163,19 +229,28 @@ class CompileUnit {
 
     DynamicArray<StackValue> abstract_stack{};
     decltype(stack_height) abstract_stack_height;
+    // an i1 computed by a comparison and consumed by the following POP_JUMP_IF_* instead of a pushed bool
+    llvm::Value *fused_condition{};
 
     [[no_unique_address]] std::conditional_t<debug_build, DebugInfoBuilder, NullDebugInfoBuilder> di_builder;
 
-    explicit CompileUnit(Context &context) : context{context}, di_builder{llvm_module} {};
+    CompileUnit(Context &context, BumpArena &arena) : context{context}, arena{arena}, di_builder{llvm_module} {};
 
     void parseCFG();
     void doIntraBlockAnalysis();
     void doInterBlockAnalysis();
-    void translate();
+    void analyzeTryRegions();
+    void selectLoopRegions();
+    void translate(bool loops_only, bool profiling);
+    void emitInterpreterExit(PyBasicBlock &this_block);
+    llvm::BasicBlock *getInterpreterEntryBlock();
+    PyObject *copyCodeWithInterpreterExits();
     void emitBlock(PyBasicBlock &this_block);
     void emitRotN(PyOparg n);
     void refreshAbstractStack();
     void declareStackGrowth(int n);
+    int addResumePoint(llvm::BasicBlock *block);
+    void registerTryHandler(PyBasicBlock &setup_block);
 
     std::pair<llvm::Value *, llvm::Value *> do_GETLOCAL(PyOparg oparg);
     llvm::Value *getName(int i);
@@ -195,6 +270,7 @@ class CompileUnit {
     };
 
     FetchedStackValue fetchStackValue(int i);
+    PyObject *fetchStackConstant(int i);
 
     struct PoppedStackValue {
         llvm::Value *const value;
@@ -238,13 +314,50 @@ class CompileUnit {
 
     // TODO: FetchedStackValue等其他要不要实现INCREF和XDECREF
 
+    bool isFollowedByPopJump(PyBasicBlock &current, unsigned vpc);
     void pyJumpIF(PyBasicBlock &current, bool pop_if_jump, bool jump_cond);
+    llvm::BasicBlock *jumpTarget(PyBasicBlock &current);
+    llvm::MDNode *branchWeights(PyBasicBlock &current, bool jump_if_true);
+    void recordOperandTypes(llvm::Value *left, llvm::Value *right);
+    const ObservedTypes *monomorphicTypes();
+    llvm::BasicBlock *emitArithmeticFastPath(llvm::Value *left, llvm::Value *right,
+            llvm::SmallVectorImpl<std::pair<llvm::Value *, llvm::BasicBlock *>> &results);
     llvm::Value *getSymbol(size_t offset);
+    void emitCounterIncrement(llvm::Value *counters, size_t index);
+    void syncLasti();
+    void emitEvalBreakerCheck();
+    llvm::BasicBlock *getErrorBlock();
+    llvm::Value *loadSmallInt(llvm::Value *py_int, llvm::BasicBlock *b_fail);
+    llvm::Value *loadIndex(PyObject *const_sub, llvm::Value *sub, llvm::BasicBlock *b_fail);
+    llvm::Value *checkIndexInRange(llvm::Value *index, llvm::Value *size, llvm::BasicBlock *b_fail);
+    void emitBufferItem(PyObject *const_sub, llvm::Value *container, llvm::Value *container_type, llvm::Value *sub,
+            llvm::BasicBlock *b_slow, llvm::BasicBlock *b_end,
+            llvm::SmallVectorImpl<std::pair<llvm::Value *, llvm::BasicBlock *>> &results);
+    void emit_BINARY_SUBSCR();
+    void emit_STORE_SUBSCR();
+    void emit_FORMAT_VALUE(PyOparg oparg, bool is_deferred);
+    void emit_BUILD_STRING(PyOparg oparg);
+    llvm::Value *isAllocationTraced();
+    void initNewReference(llvm::Value *py_obj);
+    void emitGcTrack(llvm::Value *py_obj);
+    llvm::Value *emitBoxFloat(llvm::Value *value);
+    void emit_BUILD_TUPLE(PyOparg oparg);
+    void emit_BUILD_LIST(PyOparg oparg);
+    bool emitConstantProbe(PyObject *const_container, llvm::Value *container, llvm::Value *item,
+            llvm::BasicBlock *b_slow, llvm::BasicBlock *b_end, llvm::SmallVectorImpl<std::pair<llvm::Value *, llvm::BasicBlock *>> &results);
+    void emit_COMPARE_OP(PyOparg oparg, bool is_fused);
+    void emit_CONTAINS_OP(PyOparg oparg, bool is_fused);
+    void emit_UNPACK_SEQUENCE(PyOparg oparg);
+    void emitCondition(llvm::Value *cond, bool is_fused);
 
     template <typename T>
     std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>, llvm::Constant *>
     asValue(T t) { return llvm::ConstantInt::get(context.type<T>(), t); }
 
+    auto asPointer(const void *address, const llvm::Twine &name = "") {
+        return builder.CreateIntToPtr(asValue(reinterpret_cast<uintptr_t>(address)), context.type<void *>(), name);
+    }
+
     auto createBlock(const llvm::Twine &name) {
         return llvm::BasicBlock::Create(context.llvm_context, name, nullptr);
     }
@@ -276,6 +389,12 @@ class CompileUnit {
         return load_inst;
     }
 
+    template <typename T>
+    auto loadElementValue(llvm::Value *base, llvm::Value *index, llvm::MDNode *tbaa_node, const llvm::Twine &name = "") {
+        auto ptr = builder.CreateInBoundsGEP(context.type<T>(), base, index);
+        return loadValue<T>(ptr, tbaa_node, name);
+    }
+
     template <typename T, typename M>
     auto loadFieldValue(llvm::Value *instance, M T::* member, llvm::MDNode *tbaa_node, const llvm::Twine &name = "") {
         auto ptr = getPointer(instance, member);
@@ -295,24 +414,52 @@ class CompileUnit {
         return storeValue<M>(value, ptr, tbaa_node);
     }
 
-    template <llvm::AttributeList Context::* Attr = &Context::attr_default_call>
+    // f_lasti is only stored before calls, since the callee may raise or look at the frame,
+    // so every call stores it unless its attributes tell that it does neither
+    template <llvm::AttributeList Context::* Attr = &Context::attr_default_call,
+            bool SyncLasti = Attr != &Context::attr_frameless_call>
     llvm::CallInst *callFunction(llvm::FunctionType *type, llvm::Value *callee, auto &&... args) {
+        if constexpr (SyncLasti) {
+            syncLasti();
+        }
         auto call_instr = builder.CreateCall(type, callee, {args...});
         call_instr->setAttributes(context.*Attr);
         return call_instr;
     }
 
+    // these take the vpc as an argument instead
+    template <auto &Symbol>
+    static constexpr bool ignoresLasti() {
+        return IsSameSymbol<Symbol, raiseException>::value ||
+                IsSameSymbol<Symbol, resumeInInterpreter>::value;
+    }
+
     template <auto &Symbol, llvm::AttributeList Context::* Attr = &Context::attr_default_call>
     llvm::CallInst *callSymbol(auto &&... args) {
         auto type = context.type<std::remove_reference_t<decltype(Symbol)>>();
         auto callee = getSymbol(searchSymbol<Symbol>());
-        auto call = callFunction<Attr>(type, callee, static_cast<llvm::Value *>(args)...);
+        // counted before the call, which may raise and never come back
+        if constexpr (Attr != &Context::attr_refcnt_call) {
+            if (count_helper_calls) {
+                emitCounterIncrement(getSymbol(searchSymbol<helper_calls>()), searchSymbol<Symbol>());
+            }
+            if (profile) {
+                emitCounterIncrement(profile_counts, profile->block_num + emitting_vpc);
+            }
+        }
+        auto call = callFunction<Attr, Attr != &Context::attr_frameless_call && !ignoresLasti<Symbol>()>(
+                type, callee, static_cast<llvm::Value *>(args)...);
         if constexpr (Attr == &Context::attr_refcnt_call) {
             call->setCallingConv(llvm::CallingConv::PreserveMost);
         }
         return call;
     }
 
+    template <auto &Type>
+    llvm::Value *isExactType(llvm::Value *ob_type) {
+        return builder.CreateICmpEQ(ob_type, getSymbol(searchSymbol<Type>()));
+    }
+
     template <auto &Symbol>
     void emit_UNARY_OP() {
         auto value = do_POP();
@@ -325,7 +472,20 @@ class CompileUnit {
     void emit_BINARY_OP() {
         auto right = do_POP();
         auto left = do_POP();
-        auto res = callSymbol<Symbol>(left, right);
+        recordOperandTypes(left, right);
+        llvm::SmallVector<std::pair<llvm::Value *, llvm::BasicBlock *>, 2> results;
+        auto b_end = emitArithmeticFastPath(left, right, results);
+        llvm::Value *res = callSymbol<Symbol>(left, right);
+        if (b_end) {
+            results.emplace_back(res, builder.GetInsertBlock());
+            builder.CreateBr(b_end);
+            builder.SetInsertPoint(b_end);
+            auto phi = builder.CreatePHI(context.type<PyObject *>(), results.size());
+            for (auto &[v, b] : results) {
+                phi->addIncoming(v, b);
+            }
+            res = phi;
+        }
         do_PUSH(res);
         do_Py_DECREF(left);
         do_Py_DECREF(right);
@@ -334,7 +494,31 @@ class CompileUnit {
 public:
     struct TranslatedResult {
         llvm::sys::MemoryBlock mem_block;
-        DynamicArray<decltype(PyFrameObject::f_stackdepth)> sp_map;
+        DynamicArray<VpcRange> sp_ranges;
+        int sp_range_num;
+        DynamicArray<TryRegion> try_regions;
+        DynamicArray<VpcRange> region_ranges;
+        int region_range_num;
+        size_t code_bytes;
+        // the result itself, its tables and its profile
+        size_t metadata_bytes;
+        long long compile_ns;
+        bool loops_only;
+        bool profile_guided;
+        unsigned long long calls;
+        std::unique_ptr<BlockProfile> profile;
+        // when the code was entered last, on a clock ticking at each call of any compiled code
+        unsigned long long last_call{};
+        // the code is freed only after the frames running it have left
+        unsigned active_frames{};
+        // the code and the profile are gone, the tables are kept for the generators suspended in the code
+        bool evicted{};
+        // the code object dropped it while some frames were still running the code
+        bool released{};
+        // borrowed, the code object frees the result before it goes
+        PyObject *py_code{};
+        // owned, the copy of py_code which the interpreter runs to come back at the interpreter_entry headers
+        PyObject *interpreter_code{};
 
         auto operator()(auto ...args) {
             auto f = reinterpret_cast<CompiledFunction *>(mem_block.base());
@@ -342,7 +526,23 @@ public:
         }
     };
 
-    static TranslatedResult *emit(Translator &translator, PyObject *py_code);
+    static TranslatedResult *emit(Translator &translator, PyObject *py_code, bool loops_only = false,
+            bool profiling = false, const BlockProfile *feedback = nullptr);
+
+    struct AnalysisStatistics {
+        // nanoseconds spent in each pass
+        long long parse_cfg;
+        long long intra_block;
+        long long inter_block;
+        long long try_regions;
+        size_t allocated_bytes;
+        unsigned instr_num;
+        unsigned block_num;
+        unsigned try_block_num;
+    };
+
+    // run only the bytecode analysis passes, without generating any IR
+    static AnalysisStatistics analyze(Translator &translator, PyObject *py_code);
 };
 
 #endif
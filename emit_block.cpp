@@ -18,9 +18,14 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
     auto start_index = &this_block == blocks.getPointer() ? 0 : (&this_block)[-1].end_index;
     for (auto vpc : IntRange(start_index, this_block.end_index)) {
         // 注意stack_height记录于此，这就意味着在调用”风险函数“之前不允许DECREF，否则可能DEC两次
-        storeValue<decltype(PyFrameObject::f_lasti)>(asValue(vpc), rt_lasti, context.tbaa_frame_value);
+        // f_lasti is stored lazily by callSymbol and before suspending
+        emitting_vpc = vpc;
         vpc_to_stack_height[vpc] = stack_height;
         di_builder.setLocation(builder, vpc);
+        if (vpc == start_index && this_block.loop_header) {
+            // like ceval.c, let signal handlers, pending calls and other threads run once per iteration
+            emitEvalBreakerCheck();
+        }
 
         auto opcode = (py_instr + vpc).opcode();
         auto oparg = (py_instr + vpc).rawOparg();
@@ -106,13 +111,10 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             if (!defined_locals.get(oparg)) {
                 auto ok_block = appendBlock("LOAD_FAST.OK");
                 // TODO: goto error提取为一个函数来实现
-                builder.CreateCondBr(builder.CreateICmpNE(value, context.c_null), ok_block, error_block, context.likely_true);
+                builder.CreateCondBr(builder.CreateICmpNE(value, context.c_null), ok_block, getErrorBlock(), context.likely_true);
                 builder.SetInsertPoint(ok_block);
             }
             auto is_redundant = redundant_loads.get(vpc);
-            if (!is_redundant) {
-                do_Py_INCREF(value);
-            }
             if (is_redundant) {
                 do_RedundantPUSH(value, true, oparg);
             } else {
@@ -137,7 +139,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto [slot, value] = do_GETLOCAL(oparg);
             if (!defined_locals.get(oparg)) {
                 auto ok_block = appendBlock("DELETE_FAST.OK");
-                builder.CreateCondBr(builder.CreateICmpNE(value, context.c_null), ok_block, error_block, context.likely_true);
+                builder.CreateCondBr(builder.CreateICmpNE(value, context.c_null), ok_block, getErrorBlock(), context.likely_true);
                 builder.SetInsertPoint(ok_block);
             }
             storeValue<PyObject *>(context.c_null, slot, context.tbaa_frame_value);
@@ -149,7 +151,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto cell = getFreevar(oparg);
             auto value = loadFieldValue(cell, &PyCellObject::ob_ref, context.tbaa_obj_field);
             auto ok_block = appendBlock("LOAD_DEREF.OK");
-            builder.CreateCondBr(builder.CreateICmpNE(value, context.c_null), ok_block, error_block, context.likely_true);
+            builder.CreateCondBr(builder.CreateICmpNE(value, context.c_null), ok_block, getErrorBlock(), context.likely_true);
             builder.SetInsertPoint(ok_block);
             do_Py_INCREF(value);
             do_PUSH(value);
@@ -173,7 +175,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto cell_slot = getPointer(cell, &PyCellObject::ob_ref);
             auto old_value = loadValue<PyObject *>(cell_slot, context.tbaa_obj_field);
             auto ok_block = appendBlock("DELETE_DEREF.OK");
-            builder.CreateCondBr(builder.CreateICmpNE(old_value, context.c_null), ok_block, error_block, context.likely_true);
+            builder.CreateCondBr(builder.CreateICmpNE(old_value, context.c_null), ok_block, getErrorBlock(), context.likely_true);
             builder.SetInsertPoint(ok_block);
             storeValue<PyObject *>(context.c_null, cell_slot, context.tbaa_obj_field);
             do_Py_DECREF(old_value);
@@ -238,23 +240,17 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             break;
         }
         case BINARY_SUBSCR: {
-            emit_BINARY_OP<handle_BINARY_SUBSCR>();
+            emit_BINARY_SUBSCR();
             break;
         }
         case STORE_SUBSCR: {
-            auto sub = do_POP();
-            auto container = do_POP();
-            auto value = do_POP();
-            callSymbol<handle_STORE_SUBSCR>(container, sub, value);
-            do_Py_DECREF(value);
-            do_Py_DECREF(container);
-            do_Py_DECREF(sub);
+            emit_STORE_SUBSCR();
             break;
         }
         case DELETE_SUBSCR: {
             auto sub = do_POP();
             auto container = do_POP();
-            callSymbol<handle_STORE_SUBSCR>(container, sub, context.c_null);
+            callSymbol<handle_DELETE_SUBSCR>(container, sub);
             do_Py_DECREF(container);
             do_Py_DECREF(sub);
             break;
@@ -380,37 +376,20 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             break;
         }
         case COMPARE_OP: {
-            auto right = do_POP();
-            auto left = do_POP();
-            // TODO: asValue应该是形参类型
-            auto res = callSymbol<handle_COMPARE_OP>(left, right, asValue<int>(oparg));
-            do_PUSH(res);
-            do_Py_DECREF(left);
-            do_Py_DECREF(right);
+            emit_COMPARE_OP(oparg, isFollowedByPopJump(this_block, vpc));
             break;
         }
         case IS_OP: {
             auto right = do_POP();
             auto left = do_POP();
-            auto py_true = getSymbol(searchSymbol<_Py_TrueStruct>());
-            auto py_false = getSymbol(searchSymbol<_Py_FalseStruct>());
-            auto value_for_true = !oparg ? py_true : py_false;
-            auto value_for_false = !oparg ? py_false : py_true;
-            builder.CreateSelect(builder.CreateICmpEQ(left, right), value_for_true, value_for_false);
+            auto is_same = builder.CreateICmpEQ(left, right);
+            do_Py_DECREF(left);
+            do_Py_DECREF(right);
+            emitCondition(oparg ? builder.CreateNot(is_same) : is_same, isFollowedByPopJump(this_block, vpc));
             break;
         }
         case CONTAINS_OP: {
-            auto right = do_POP();
-            auto left = do_POP();
-            auto res = callSymbol<handle_CONTAINS_OP>(left, right, asValue<bool>(oparg));
-            auto py_true = getSymbol(searchSymbol<_Py_TrueStruct>());
-            auto py_false = getSymbol(searchSymbol<_Py_FalseStruct>());
-            auto value_for_true = !oparg ? py_true : py_false;
-            auto value_for_false = !oparg ? py_false : py_true;
-            auto value = builder.CreateSelect(res, value_for_true, value_for_false);
-            do_PUSH(value);
-            do_Py_DECREF(left);
-            do_Py_DECREF(right);
+            emit_CONTAINS_OP(oparg, isFollowedByPopJump(this_block, vpc));
             break;
         }
         case RETURN_VALUE: {
@@ -457,7 +436,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             break;
         }
         case LOAD_CLOSURE: {
-            auto cell = loadValue<PyObject *>(getFreevar(oparg), context.tbaa_code_const);
+            auto cell = getFreevar(oparg);
             do_Py_INCREF(cell);
             do_PUSH(cell);
             break;
@@ -468,7 +447,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto globals = loadFieldValue(frame_obj, &PyFrameObject::f_globals, context.tbaa_code_const);
             auto py_func = callSymbol<PyFunction_NewWithQualName>(codeobj, globals, qualname);
             auto ok_block = appendBlock("MAKE_FUNCTION.OK");
-            builder.CreateCondBr(builder.CreateICmpNE(py_func, context.c_null), ok_block, error_block, context.likely_true);
+            builder.CreateCondBr(builder.CreateICmpNE(py_func, context.c_null), ok_block, getErrorBlock(), context.likely_true);
             builder.SetInsertPoint(ok_block);
             // TODO: 一个新的tbaa
             if (oparg & 8) {
@@ -557,31 +536,26 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto next = callFunction(context.type<remove_pointer_t<iternextfunc>>(), the_iternextfunc, iter);
             do_PUSH(next);
             auto b_break = appendBlock("FOR_ITER.break");
-            builder.CreateCondBr(builder.CreateICmpEQ(next, context.c_null), b_break, this_block.next());
+            builder.CreateCondBr(builder.CreateICmpEQ(next, context.c_null), b_break, this_block.next(),
+                    branchWeights(this_block, true));
             // iteration should break
             builder.SetInsertPoint(b_break);
             callSymbol<handle_FOR_ITER>();
             do_Py_DECREF(iter.value);
-            builder.CreateBr(*this_block.branch);
+            builder.CreateBr(jumpTarget(this_block));
             break;
         }
 
         case BUILD_STRING: {
-            auto values = do_POP_N(oparg);
-            auto str = callSymbol<handle_BUILD_STRING>(values, asValue<Py_ssize_t>(oparg));
-            do_PUSH(str);
+            emit_BUILD_STRING(oparg);
             break;
         }
         case BUILD_TUPLE: {
-            auto values = do_POP_N(oparg);
-            auto map = callSymbol<handle_BUILD_TUPLE>(values, asValue<Py_ssize_t>(oparg));
-            do_PUSH(map);
+            emit_BUILD_TUPLE(oparg);
             break;
         }
         case BUILD_LIST: {
-            auto values = do_POP_N(oparg);
-            auto map = callSymbol<handle_BUILD_LIST>(values, asValue<Py_ssize_t>(oparg));
-            do_PUSH(map);
+            emit_BUILD_LIST(oparg);
             break;
         }
         case BUILD_SET: {
@@ -663,12 +637,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
         }
 
         case FORMAT_VALUE: {
-            auto fmt_spec = (oparg & FVS_MASK) == FVS_HAVE_SPEC ? do_POP() : context.c_null;
-            auto value = do_POP();
-            int which_conversion = oparg & FVC_MASK;
-            auto result = callSymbol<handle_FORMAT_VALUE>(value, fmt_spec, asValue(which_conversion));
-            do_PUSH(result);
-            do_Py_DECREF(value);
+            emit_FORMAT_VALUE(oparg, deferred_formats.get(vpc));
             break;
         }
         case BUILD_SLICE: {
@@ -725,10 +694,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
         }
 
         case UNPACK_SEQUENCE: {
-            auto seq = do_POP();
-            callSymbol<handle_UNPACK_SEQUENCE>(seq, asValue<Py_ssize_t>(oparg), getStackSlot());
-            do_Py_DECREF(seq);
-            declareStackGrowth(oparg);
+            emit_UNPACK_SEQUENCE(oparg);
             break;
         }
         case UNPACK_EX: {
@@ -785,17 +751,11 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
         }
 
         case SETUP_FINALLY: {
-            entry_jump->addDestination(*this_block.branch);
-            auto block_addr_diff = builder.CreateIntCast(builder.CreateSub(
-                    builder.CreatePtrToInt(BlockAddress::get(function, *this_block.branch), context.type<uintptr_t>()),
-                    builder.CreatePtrToInt(BlockAddress::get(function, blocks[0]), context.type<uintptr_t>())
-            ), context.type<int>(), true);
-            callSymbol<PyFrame_BlockSetup>(frame_obj, asValue<int>(SETUP_FINALLY), block_addr_diff, asValue<int>(stack_height));
+            registerTryHandler(this_block);
             builder.CreateBr(this_block.next());
             break;
         }
         case POP_BLOCK: {
-            callSymbol<PyFrame_BlockPop>(frame_obj);
             break;
         }
         case POP_EXCEPT: {
@@ -811,7 +771,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto match = callSymbol<handle_JUMP_IF_NOT_EXC_MATCH>(left, right);
             do_Py_DECREF(left);
             do_Py_DECREF(right);
-            builder.CreateCondBr(match, this_block.next(), *this_block.branch);
+            builder.CreateCondBr(match, this_block.next(), jumpTarget(this_block), branchWeights(this_block, false));
             break;
         }
         case RERAISE: {
@@ -820,13 +780,9 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             break;
         }
         case SETUP_WITH: {
-            entry_jump->addDestination(*this_block.branch);
-            auto block_addr_diff = builder.CreateIntCast(builder.CreateSub(
-                    builder.CreatePtrToInt(BlockAddress::get(function, *this_block.branch), context.type<uintptr_t>()),
-                    builder.CreatePtrToInt(BlockAddress::get(function, blocks[0]), context.type<uintptr_t>())
-            ), context.type<int>(), true);
-            callSymbol<handle_SETUP_WITH>(frame_obj, getStackSlot(), block_addr_diff);
+            callSymbol<handle_SETUP_WITH>(getStackSlot());
             stack_height += 1;
+            registerTryHandler(this_block);
             builder.CreateBr(this_block.next());
             break;
         }
@@ -845,7 +801,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             do_Py_DECREF(should_be_none);
             auto py_none = getSymbol(searchSymbol<_Py_NoneStruct>());
             auto ok_block = appendBlock("GEN_START.OK");
-            builder.CreateCondBr(builder.CreateICmpEQ(should_be_none, py_none), ok_block, error_block, context.likely_true);
+            builder.CreateCondBr(builder.CreateICmpEQ(should_be_none, py_none), ok_block, getErrorBlock(), context.likely_true);
             builder.SetInsertPoint(ok_block);
             break;
         }
@@ -859,12 +815,9 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
                 retval = do_POP_with_newref();
             }
             auto resume_block = appendBlock("YIELD_VALUE.resume");
-            entry_jump->addDestination(resume_block);
-            auto block_addr_diff = builder.CreateIntCast(builder.CreateSub(
-                    builder.CreatePtrToInt(BlockAddress::get(function, resume_block), context.type<uintptr_t>()),
-                    builder.CreatePtrToInt(BlockAddress::get(function, blocks[0]), context.type<uintptr_t>())
-            ), context.type<int>(), true);
-            storeValue<int>(block_addr_diff, coroutine_handler, context.tbaa_frame_value);
+            auto resume_id = addResumePoint(resume_block);
+            syncLasti();
+            storeValue<int>(asValue(resume_id), coroutine_handler, context.tbaa_frame_value);
             storeFiledValue(asValue<PyFrameState>(FRAME_SUSPENDED), frame_obj, &PyFrameObject::f_state, context.tbaa_obj_field);
             storeFiledValue(asValue<int>(stack_height), frame_obj, &PyFrameObject::f_stackdepth, context.tbaa_obj_field);
             builder.CreateRet(retval);
@@ -886,7 +839,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto resume_block = appendBlock("YIELD_FROM.resume");
             builder.CreateBr(resume_block);
             builder.SetInsertPoint(resume_block);
-            entry_jump->addDestination(resume_block);
+            auto resume_id = addResumePoint(resume_block);
 
             refreshAbstractStack();
 
@@ -898,7 +851,7 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             auto gen_status = callSymbol<PyIter_Send>(receiver, v, retval_ptr);
             // TODO: ok_block叫b_ok吧，或者反过来，统一化
             auto ok_block = appendBlock("YIELD_FROM.ok");
-            builder.CreateCondBr(builder.CreateICmpNE(gen_status, asValue(PYGEN_ERROR)), ok_block, error_block, context.likely_true);
+            builder.CreateCondBr(builder.CreateICmpNE(gen_status, asValue(PYGEN_ERROR)), ok_block, getErrorBlock(), context.likely_true);
             builder.SetInsertPoint(ok_block);
             auto retval = loadValue<PyObject *>(retval_ptr, nullptr, "retval");
             do_Py_DECREF(v);
@@ -907,11 +860,8 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
             builder.CreateCondBr(builder.CreateICmpEQ(gen_status, asValue(PYGEN_NEXT)), b_next, b_return, context.likely_true);
 
             builder.SetInsertPoint(b_next);
-            auto block_addr_diff = builder.CreateIntCast(builder.CreateSub(
-                    builder.CreatePtrToInt(BlockAddress::get(function, resume_block), context.type<uintptr_t>()),
-                    builder.CreatePtrToInt(BlockAddress::get(function, blocks[0]), context.type<uintptr_t>())
-            ), context.type<int>(), true);
-            storeValue<int>(block_addr_diff, coroutine_handler, context.tbaa_frame_value);
+            syncLasti();
+            storeValue<int>(asValue(resume_id), coroutine_handler, context.tbaa_frame_value);
             storeFiledValue(asValue<PyFrameState>(FRAME_SUSPENDED), frame_obj, &PyFrameObject::f_state, context.tbaa_obj_field);
             storeFiledValue(asValue<int>(stack_height + 1), frame_obj, &PyFrameObject::f_stackdepth, context.tbaa_obj_field);
             builder.CreateRet(retval);
@@ -958,19 +908,17 @@ void CompileUnit::emitBlock(PyBasicBlock &this_block) {
         }
         case SETUP_ASYNC_WITH: {
             assert(abstract_stack[abstract_stack_height - 1].really_pushed);
-            entry_jump->addDestination(*this_block.branch);
-            auto block_addr_diff = builder.CreateIntCast(builder.CreateSub(
-                    builder.CreatePtrToInt(BlockAddress::get(function, *this_block.branch), context.type<uintptr_t>()),
-                    builder.CreatePtrToInt(BlockAddress::get(function, blocks[0]), context.type<uintptr_t>())
-            ), context.type<int>(), true);
-            callSymbol<PyFrame_BlockSetup>(frame_obj, asValue<int>(SETUP_FINALLY), block_addr_diff, asValue<int>(stack_height - 1));
+            registerTryHandler(this_block);
             builder.CreateBr(this_block.next());
             break;
         }
         case BEFORE_ASYNC_WITH: {
+            // not a block boundary, so reload the pushed __aexit__ and result of __aenter__
+            assert(abstract_stack[abstract_stack_height - 1].really_pushed);
             callSymbol<handle_BEFORE_ASYNC_WITH>(getStackSlot());
-            stack_height += 1;
-            builder.CreateBr(this_block.next());
+            abstract_stack_height--;
+            stack_height--;
+            declareStackGrowth(2);
             break;
         }
         default:
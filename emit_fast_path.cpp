@@ -0,0 +1,912 @@
+#include <Python.h>
+
+#undef HAVE_STD_ATOMIC
+
+#include <internal/pycore_interp.h>
+#include <internal/pycore_pymem.h>
+
+#include "compile_unit.h"
+
+using namespace std;
+using namespace llvm;
+
+Value *CompileUnit::loadSmallInt(Value *py_int, BasicBlock *b_fail) {
+    auto b_exact_int = appendBlock("small_int.exact");
+    auto b_ok = appendBlock("small_int.ok");
+    auto ob_type = loadFieldValue(py_int, &PyObject::ob_type, context.tbaa_obj_field);
+    builder.CreateCondBr(isExactType<PyLong_Type>(ob_type), b_exact_int, b_fail, context.likely_true);
+    builder.SetInsertPoint(b_exact_int);
+    auto size = loadFieldValue(py_int, &PyVarObject::ob_size, context.tbaa_obj_field);
+    // only ints with at most one digit, i.e. ob_size in {-1, 0, 1}
+    auto size_plus_1 = builder.CreateAdd(size, asValue<Py_ssize_t>(1));
+    builder.CreateCondBr(builder.CreateICmpULE(size_plus_1, asValue<Py_ssize_t>(2)), b_ok, b_fail, context.likely_true);
+    builder.SetInsertPoint(b_ok);
+    // ob_digit[0] of zero is meaningless but still readable, and multiplied by ob_size=0 anyway
+    auto digit_value = loadValue<digit>(getPointer(py_int, &PyLongObject::ob_digit), context.tbaa_obj_field);
+    return builder.CreateMul(size, builder.CreateZExt(digit_value, context.type<Py_ssize_t>()));
+}
+
+static bool mayBeIndex(PyObject *const_sub) {
+    if (!const_sub) {
+        return true;
+    }
+    if (!PyLong_CheckExact(const_sub)) {
+        return false;
+    }
+    int overflow;
+    PyLong_AsLongAndOverflow(const_sub, &overflow);
+    return !overflow;
+}
+
+static Py_hash_t hashConstant(PyObject *const_key) {
+    if (!const_key) {
+        return -1;
+    }
+    auto hash = PyObject_Hash(const_key);
+    if (hash == -1) {
+        PyErr_Clear();
+    }
+    return hash;
+}
+
+Value *CompileUnit::loadIndex(PyObject *const_sub, Value *sub, BasicBlock *b_fail) {
+    if (const_sub) {
+        return asValue<Py_ssize_t>(PyLong_AsSsize_t(const_sub));
+    }
+    return loadSmallInt(sub, b_fail);
+}
+
+Value *CompileUnit::checkIndexInRange(Value *index, Value *size, BasicBlock *b_fail) {
+    auto b_in_range = appendBlock("index.in_range");
+    auto is_negative = builder.CreateICmpSLT(index, asValue<Py_ssize_t>(0));
+    index = builder.CreateSelect(is_negative, builder.CreateAdd(index, size), index);
+    builder.CreateCondBr(builder.CreateICmpULT(index, size), b_in_range, b_fail, context.likely_true);
+    builder.SetInsertPoint(b_in_range);
+    return index;
+}
+
+void CompileUnit::emitBufferItem(PyObject *const_sub, Value *container, Value *container_type, Value *sub,
+        BasicBlock *b_slow, BasicBlock *b_end, SmallVectorImpl<pair<Value *, BasicBlock *>> &results) {
+    // the items of bytes and bytearray are unsigned bytes, boxed as cached small ints
+    auto b_bytes = appendBlock("BINARY_SUBSCR.bytes");
+    auto b_not_bytes = appendBlock("BINARY_SUBSCR.not_bytes");
+    auto b_bytearray = appendBlock("BINARY_SUBSCR.bytearray");
+    auto b_not_bytearray = appendBlock("BINARY_SUBSCR.not_bytearray");
+    auto b_byte = appendBlock("BINARY_SUBSCR.byte");
+    builder.CreateCondBr(isExactType<PyBytes_Type>(container_type), b_bytes, b_not_bytes);
+    builder.SetInsertPoint(b_bytes);
+    auto bytes_data = getPointer(container, &PyBytesObject::ob_sval);
+    builder.CreateBr(b_byte);
+    builder.SetInsertPoint(b_not_bytes);
+    builder.CreateCondBr(isExactType<PyByteArray_Type>(container_type), b_bytearray, b_not_bytearray);
+    builder.SetInsertPoint(b_bytearray);
+    auto bytearray_data = loadFieldValue(container, &PyByteArrayObject::ob_start, context.tbaa_obj_field);
+    builder.CreateBr(b_byte);
+
+    builder.SetInsertPoint(b_byte);
+    auto data = builder.CreatePHI(context.type<char *>(), 2);
+    data->addIncoming(bytes_data, b_bytes);
+    data->addIncoming(bytearray_data, b_bytearray);
+    auto size = loadFieldValue(container, &PyVarObject::ob_size, context.tbaa_obj_field);
+    auto index = checkIndexInRange(loadIndex(const_sub, sub, b_slow), size, b_slow);
+    auto byte = loadElementValue<char>(data, index, context.tbaa_obj_field);
+    auto byte_item = callSymbol<boxInt>(builder.CreateZExt(byte, context.type<Py_ssize_t>()));
+    results.emplace_back(byte_item, builder.GetInsertBlock());
+    builder.CreateBr(b_end);
+
+    // a memoryview is read in place if it is one-dimensional without suboffsets, and of doubles or unsigned bytes
+    builder.SetInsertPoint(b_not_bytearray);
+    auto b_memoryview = appendBlock("BINARY_SUBSCR.memoryview");
+    auto b_not_memoryview = appendBlock("BINARY_SUBSCR.not_memoryview");
+    auto b_known_format = appendBlock("BINARY_SUBSCR.known_format");
+    auto b_view_item = appendBlock("BINARY_SUBSCR.view_item");
+    auto b_view_double = appendBlock("BINARY_SUBSCR.view_double");
+    auto b_view_byte = appendBlock("BINARY_SUBSCR.view_byte");
+    builder.CreateCondBr(isExactType<PyMemoryView_Type>(container_type), b_memoryview, b_not_memoryview);
+    builder.SetInsertPoint(b_memoryview);
+    auto mbuf = loadFieldValue(container, &PyMemoryViewObject::mbuf, context.tbaa_obj_field);
+    auto view_flags = loadFieldValue(container, &PyMemoryViewObject::flags, context.tbaa_obj_field);
+    auto mbuf_flags = loadFieldValue(mbuf, &_PyManagedBufferObject::flags, context.tbaa_obj_field);
+    auto view = getPointer(container, &PyMemoryViewObject::view);
+    auto ndim = loadFieldValue(view, &Py_buffer::ndim, context.tbaa_obj_field);
+    auto suboffsets = loadFieldValue(view, &Py_buffer::suboffsets, context.tbaa_obj_field);
+    auto format = loadFieldValue(view, &Py_buffer::format, context.tbaa_obj_field);
+    auto format_char = loadValue<char>(format, context.tbaa_obj_field);
+    auto is_readable = builder.CreateAnd({
+            builder.CreateICmpEQ(builder.CreateAnd(view_flags, asValue(_Py_MEMORYVIEW_RELEASED)), asValue(0)),
+            builder.CreateICmpEQ(builder.CreateAnd(mbuf_flags, asValue(_Py_MANAGED_BUFFER_RELEASED)), asValue(0)),
+            builder.CreateICmpEQ(ndim, asValue(1)),
+            builder.CreateICmpEQ(suboffsets, context.c_null),
+            builder.CreateOr(builder.CreateICmpEQ(format_char, asValue('d')),
+                    builder.CreateICmpEQ(format_char, asValue('B')))
+    });
+    builder.CreateCondBr(is_readable, b_known_format, b_slow);
+    builder.SetInsertPoint(b_known_format);
+    auto format_end = loadElementValue<char>(format, asValue<Py_ssize_t>(1), context.tbaa_obj_field);
+    builder.CreateCondBr(builder.CreateICmpEQ(format_end, asValue('\0')), b_view_item, b_slow);
+    builder.SetInsertPoint(b_view_item);
+    auto shape = loadFieldValue(view, &Py_buffer::shape, context.tbaa_obj_field);
+    auto strides = loadFieldValue(view, &Py_buffer::strides, context.tbaa_obj_field);
+    auto length = loadValue<Py_ssize_t>(shape, context.tbaa_obj_field);
+    auto view_index = checkIndexInRange(loadIndex(const_sub, sub, b_slow), length, b_slow);
+    auto offset = builder.CreateMul(view_index, loadValue<Py_ssize_t>(strides, context.tbaa_obj_field));
+    auto item_ptr = builder.CreateInBoundsGEP(context.type<char>(),
+            loadFieldValue(view, &Py_buffer::buf, context.tbaa_obj_field), offset);
+    builder.CreateCondBr(builder.CreateICmpEQ(format_char, asValue('d')), b_view_double, b_view_byte);
+    builder.SetInsertPoint(b_view_double);
+    // the buffer of a cast memoryview may be unaligned
+    auto double_value = builder.CreateAlignedLoad(context.type<double>(), item_ptr, Align{1});
+    double_value->setMetadata(LLVMContext::MD_tbaa, context.tbaa_obj_field);
+    auto double_item = emitBoxFloat(double_value);
+    results.emplace_back(double_item, builder.GetInsertBlock());
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_view_byte);
+    auto byte_value = loadValue<char>(item_ptr, context.tbaa_obj_field);
+    results.emplace_back(callSymbol<boxInt>(builder.CreateZExt(byte_value, context.type<Py_ssize_t>())),
+            builder.GetInsertBlock());
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_not_memoryview);
+}
+
+void CompileUnit::emit_BINARY_SUBSCR() {
+    auto const_sub = fetchStackConstant(1);
+    auto sub = do_POP();
+    auto container = do_POP();
+    recordOperandTypes(container, sub);
+
+    auto b_slow = appendBlock("BINARY_SUBSCR.slow");
+    auto b_end = appendBlock("BINARY_SUBSCR.end");
+    SmallVector<pair<Value *, BasicBlock *>, 4> results;
+    auto container_type = loadFieldValue(container, &PyObject::ob_type, context.tbaa_obj_field);
+    auto try_index = mayBeIndex(const_sub);
+    auto try_sequence = try_index;
+    auto try_dict = true;
+    auto try_str = try_index;
+    auto try_buffer = try_index;
+    if (auto seen = monomorphicTypes()) {
+        try_sequence &= seen->left == &PyList_Type || seen->left == &PyTuple_Type;
+        try_dict &= seen->left == &PyDict_Type;
+        try_str &= seen->left == &PyUnicode_Type;
+        try_buffer &= seen->left == &PyBytes_Type || seen->left == &PyByteArray_Type ||
+                seen->left == &PyMemoryView_Type;
+    }
+
+    if (try_sequence) {
+        auto b_list = appendBlock("BINARY_SUBSCR.list");
+        auto b_not_list = appendBlock("BINARY_SUBSCR.not_list");
+        auto b_tuple = appendBlock("BINARY_SUBSCR.tuple");
+        auto b_not_tuple = appendBlock("BINARY_SUBSCR.not_tuple");
+        auto b_sequence = appendBlock("BINARY_SUBSCR.sequence");
+        builder.CreateCondBr(isExactType<PyList_Type>(container_type), b_list, b_not_list);
+        builder.SetInsertPoint(b_list);
+        auto list_items = loadFieldValue(container, &PyListObject::ob_item, context.tbaa_obj_field);
+        builder.CreateBr(b_sequence);
+        builder.SetInsertPoint(b_not_list);
+        builder.CreateCondBr(isExactType<PyTuple_Type>(container_type), b_tuple, b_not_tuple);
+        builder.SetInsertPoint(b_tuple);
+        auto tuple_items = getPointer(container, &PyTupleObject::ob_item);
+        builder.CreateBr(b_sequence);
+
+        builder.SetInsertPoint(b_sequence);
+        auto items = builder.CreatePHI(context.type<PyObject **>(), 2);
+        items->addIncoming(list_items, b_list);
+        items->addIncoming(tuple_items, b_tuple);
+        auto size = loadFieldValue(container, &PyVarObject::ob_size, context.tbaa_obj_field);
+        // out of range index goes to the slow path which raises IndexError
+        auto index = checkIndexInRange(loadIndex(const_sub, sub, b_slow), size, b_slow);
+        auto item = loadElementValue<PyObject *>(items, index, context.tbaa_obj_field);
+        do_Py_INCREF(item);
+        results.emplace_back(item, builder.GetInsertBlock());
+        builder.CreateBr(b_end);
+
+        builder.SetInsertPoint(b_not_tuple);
+    }
+
+    if (try_dict) {
+        auto b_dict = appendBlock("BINARY_SUBSCR.dict");
+        auto b_not_dict = appendBlock("BINARY_SUBSCR.not_dict");
+        builder.CreateCondBr(isExactType<PyDict_Type>(container_type), b_dict, b_not_dict);
+        builder.SetInsertPoint(b_dict);
+        auto hash = asValue(hashConstant(const_sub));
+        auto dict_item = callSymbol<handle_BINARY_SUBSCR_DICT>(container, sub, hash);
+        results.emplace_back(dict_item, builder.GetInsertBlock());
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_not_dict);
+    }
+
+    if (try_str) {
+        auto b_str = appendBlock("BINARY_SUBSCR.str");
+        auto b_not_str = appendBlock("BINARY_SUBSCR.not_str");
+        builder.CreateCondBr(isExactType<PyUnicode_Type>(container_type), b_str, b_not_str);
+        builder.SetInsertPoint(b_str);
+        auto str_item = callSymbol<handle_BINARY_SUBSCR_STR>(container, loadIndex(const_sub, sub, b_slow));
+        results.emplace_back(str_item, builder.GetInsertBlock());
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_not_str);
+    }
+    if (try_buffer) {
+        emitBufferItem(const_sub, container, container_type, sub, b_slow, b_end, results);
+    }
+    builder.CreateBr(b_slow);
+
+    builder.SetInsertPoint(b_slow);
+    auto slow_item = callSymbol<handle_BINARY_SUBSCR>(container, sub);
+    results.emplace_back(slow_item, builder.GetInsertBlock());
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_end);
+    auto res = builder.CreatePHI(context.type<PyObject *>(), results.size());
+    for (auto &[v, b] : results) {
+        res->addIncoming(v, b);
+    }
+    do_PUSH(res);
+    do_Py_DECREF(container);
+    do_Py_DECREF(sub);
+}
+
+void CompileUnit::emit_STORE_SUBSCR() {
+    auto const_sub = fetchStackConstant(1);
+    auto sub = do_POP();
+    auto container = do_POP();
+    auto value = do_POP();
+
+    auto b_slow = appendBlock("STORE_SUBSCR.slow");
+    auto b_release = appendBlock("STORE_SUBSCR.release");
+    auto b_end = appendBlock("STORE_SUBSCR.end");
+    auto container_type = loadFieldValue(container, &PyObject::ob_type, context.tbaa_obj_field);
+
+    if (mayBeIndex(const_sub)) {
+        auto b_list = appendBlock("STORE_SUBSCR.list");
+        auto b_not_list = appendBlock("STORE_SUBSCR.not_list");
+        builder.CreateCondBr(isExactType<PyList_Type>(container_type), b_list, b_not_list);
+        builder.SetInsertPoint(b_list);
+        auto size = loadFieldValue(container, &PyVarObject::ob_size, context.tbaa_obj_field);
+        auto index = checkIndexInRange(loadIndex(const_sub, sub, b_slow), size, b_slow);
+        auto items = loadFieldValue(container, &PyListObject::ob_item, context.tbaa_obj_field);
+        auto slot = builder.CreateInBoundsGEP(context.type<PyObject *>(), items, index);
+        auto old_item = loadValue<PyObject *>(slot, context.tbaa_obj_field);
+        // the list steals the reference of value
+        if (!value.really_pushed) {
+            do_Py_INCREF(value);
+        }
+        storeValue<PyObject *>(value, slot, context.tbaa_obj_field);
+        do_Py_DECREF(old_item);
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_not_list);
+    }
+
+    auto b_dict = appendBlock("STORE_SUBSCR.dict");
+    builder.CreateCondBr(isExactType<PyDict_Type>(container_type), b_dict, b_slow);
+    builder.SetInsertPoint(b_dict);
+    auto hash = asValue(hashConstant(const_sub));
+    callSymbol<handle_STORE_SUBSCR_DICT>(container, sub, value, hash);
+    builder.CreateBr(b_release);
+
+    builder.SetInsertPoint(b_slow);
+    callSymbol<handle_STORE_SUBSCR>(container, sub, value);
+    builder.CreateBr(b_release);
+
+    builder.SetInsertPoint(b_release);
+    do_Py_DECREF(value);
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_end);
+    do_Py_DECREF(container);
+    do_Py_DECREF(sub);
+}
+
+void CompileUnit::emit_FORMAT_VALUE(PyOparg oparg, bool is_deferred) {
+    int which_conversion = oparg & FVC_MASK;
+    if ((oparg & FVS_MASK) == FVS_HAVE_SPEC) {
+        auto fmt_spec = do_POP();
+        auto value = do_POP();
+        auto result = callSymbol<handle_FORMAT_VALUE>(value, fmt_spec, asValue(which_conversion));
+        do_PUSH(result);
+        do_Py_DECREF(value);
+        do_Py_DECREF(fmt_spec);
+        return;
+    }
+
+    auto value = do_POP();
+    if (which_conversion != FVC_NONE && which_conversion != FVC_STR) {
+        auto result = callSymbol<handle_FORMAT_VALUE>(value, context.c_null, asValue(which_conversion));
+        do_PUSH(result);
+        do_Py_DECREF(value);
+        return;
+    }
+
+    auto b_keep = appendBlock("FORMAT_VALUE.keep");
+    auto b_format = appendBlock("FORMAT_VALUE.format");
+    auto b_end = appendBlock("FORMAT_VALUE.end");
+    auto value_type = loadFieldValue(value, &PyObject::ob_type, context.tbaa_obj_field);
+    auto is_kept = isExactType<PyUnicode_Type>(value_type);
+    if (is_deferred) {
+        // BUILD_STRING renders exact int and float itself
+        is_kept = builder.CreateOr(is_kept, isExactType<PyLong_Type>(value_type));
+        is_kept = builder.CreateOr(is_kept, isExactType<PyFloat_Type>(value_type));
+    }
+    builder.CreateCondBr(is_kept, b_keep, b_format, context.likely_true);
+
+    builder.SetInsertPoint(b_keep);
+    if (!value.really_pushed) {
+        do_Py_INCREF(value);
+    }
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_format);
+    auto formatted = callSymbol<handle_FORMAT_VALUE>(value, context.c_null, asValue(which_conversion));
+    do_Py_DECREF(value);
+    auto b_formatted = builder.GetInsertBlock();
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_end);
+    auto result = builder.CreatePHI(context.type<PyObject *>(), 2);
+    result->addIncoming(value, b_keep);
+    result->addIncoming(formatted, b_formatted);
+    do_PUSH(result);
+}
+
+void CompileUnit::emit_BUILD_STRING(PyOparg oparg) {
+    IRBuilder<> entry_builder{entry_jump};
+    auto pieces = entry_builder.CreateAlloca(context.type<PyObject *>(), asValue<Py_ssize_t>(oparg));
+    SmallVector<Value *, 8> owned_pieces;
+    for (auto i = oparg; i--;) {
+        auto piece = do_POP();
+        storeValue<PyObject *>(piece, getPointer<PyObject *>(pieces, i), nullptr);
+        if (piece.really_pushed) {
+            owned_pieces.push_back(piece);
+        }
+    }
+    // pieces are borrowed by the callee, and those on the stack are released by unwinding on error
+    auto str = callSymbol<handle_BUILD_STRING>(pieces, asValue<Py_ssize_t>(oparg));
+    do_PUSH(str);
+    for (auto piece : owned_pieces) {
+        do_Py_DECREF(piece);
+    }
+}
+
+// the freelists are those of PyFloat_FromDouble, PyTuple_New and PyList_New, and objects get back to them
+// through tp_dealloc as usual, so the inline allocation only works while tracemalloc does not need to see it
+Value *CompileUnit::isAllocationTraced() {
+    auto tracing = loadValue<int>(asPointer(&_Py_tracemalloc_config.tracing), context.tbaa_allocator);
+    return builder.CreateICmpNE(tracing, asValue(0));
+}
+
+void CompileUnit::initNewReference(Value *py_obj) {
+    Value *ref = py_obj;
+    if constexpr (offsetof(PyObject, ob_refcnt)) {
+        ref = getPointer(py_obj, &PyObject::ob_refcnt);
+    }
+    storeValue<decltype(PyObject::ob_refcnt)>(asValue(decltype(PyObject::ob_refcnt){1}), ref, context.tbaa_refcnt);
+}
+
+void CompileUnit::emitGcTrack(Value *py_obj) {
+    using GcLink = decltype(PyGC_Head::_gc_prev);
+    // generation0 is set up with the interpreter and never moves
+    auto generation0 = asPointer(PyInterpreterState_Get()->gc.generation0, "generation0");
+    auto gc = getPointer<char>(py_obj, -static_cast<ptrdiff_t>(sizeof(PyGC_Head)));
+    auto gc_link = builder.CreatePtrToInt(gc, context.type<GcLink>());
+    auto last_link = loadFieldValue(generation0, &PyGC_Head::_gc_prev, context.tbaa_allocator);
+    auto last = builder.CreateIntToPtr(last_link, context.type<void *>());
+    storeFiledValue(gc_link, last, &PyGC_Head::_gc_next, context.tbaa_allocator);
+    // the flag bits of _gc_prev are kept
+    auto flags = builder.CreateAnd(loadFieldValue(gc, &PyGC_Head::_gc_prev, context.tbaa_allocator),
+            asValue(~static_cast<GcLink>(_PyGC_PREV_MASK)));
+    storeFiledValue(builder.CreateOr(flags, last_link), gc, &PyGC_Head::_gc_prev, context.tbaa_allocator);
+    storeFiledValue(builder.CreatePtrToInt(generation0, context.type<GcLink>()), gc, &PyGC_Head::_gc_next,
+            context.tbaa_allocator);
+    storeFiledValue(gc_link, generation0, &PyGC_Head::_gc_prev, context.tbaa_allocator);
+}
+
+Value *CompileUnit::emitBoxFloat(Value *value) {
+    auto &state = PyInterpreterState_Get()->float_state;
+    auto b_pop = appendBlock("box_float.pop");
+    auto b_helper = appendBlock("box_float.helper");
+    auto b_end = appendBlock("box_float.end");
+    auto free_list = asPointer(&state.free_list);
+    auto op = loadValue<PyObject *>(free_list, context.tbaa_allocator);
+    auto can_pop = builder.CreateAnd(builder.CreateICmpNE(op, context.c_null),
+            builder.CreateNot(isAllocationTraced()));
+    builder.CreateCondBr(can_pop, b_pop, b_helper, context.likely_true);
+    builder.SetInsertPoint(b_pop);
+    // free floats are linked through ob_type
+    storeValue<PyObject *>(loadFieldValue(op, &PyObject::ob_type, context.tbaa_obj_field),
+            free_list, context.tbaa_allocator);
+    auto numfree = asPointer(&state.numfree);
+    storeValue<int>(builder.CreateSub(loadValue<int>(numfree, context.tbaa_allocator), asValue(1)),
+            numfree, context.tbaa_allocator);
+    storeFiledValue(getSymbol(searchSymbol<PyFloat_Type>()), op, &PyObject::ob_type, context.tbaa_obj_field);
+    initNewReference(op);
+    storeFiledValue(value, op, &PyFloatObject::ob_fval, context.tbaa_obj_field);
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_helper);
+    auto boxed = callSymbol<boxFloat>(value);
+    auto b_helper_end = builder.GetInsertBlock();
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_end);
+    auto res = builder.CreatePHI(context.type<PyObject *>(), 2);
+    res->addIncoming(op, b_pop);
+    res->addIncoming(boxed, b_helper_end);
+    return res;
+}
+
+void CompileUnit::emit_BUILD_TUPLE(PyOparg oparg) {
+    auto values = do_POP_N(oparg);
+    // the empty tuple is a singleton, and longer ones are not kept
+    if (!oparg || oparg >= PyTuple_MAXSAVESIZE) {
+        do_PUSH(callSymbol<handle_BUILD_TUPLE>(values, asValue<Py_ssize_t>(oparg)));
+        return;
+    }
+    auto &state = PyInterpreterState_Get()->tuple;
+    auto b_pop = appendBlock("BUILD_TUPLE.pop");
+    auto b_helper = appendBlock("BUILD_TUPLE.helper");
+    auto b_end = appendBlock("BUILD_TUPLE.end");
+    auto free_list = asPointer(&state.free_list[oparg]);
+    auto op = loadValue<PyObject *>(free_list, context.tbaa_allocator);
+    auto can_pop = builder.CreateAnd(builder.CreateICmpNE(op, context.c_null),
+            builder.CreateNot(isAllocationTraced()));
+    builder.CreateCondBr(can_pop, b_pop, b_helper, context.likely_true);
+    builder.SetInsertPoint(b_pop);
+    // free tuples keep ob_type and ob_size, and are linked through ob_item[0]
+    auto items = getPointer(op, &PyTupleObject::ob_item);
+    storeValue<PyObject *>(loadValue<PyObject *>(items, context.tbaa_obj_field), free_list, context.tbaa_allocator);
+    auto numfree = asPointer(&state.numfree[oparg]);
+    storeValue<int>(builder.CreateSub(loadValue<int>(numfree, context.tbaa_allocator), asValue(1)),
+            numfree, context.tbaa_allocator);
+    initNewReference(op);
+    for (auto i : IntRange(oparg)) {
+        auto item = loadValue<PyObject *>(getPointer<PyObject *>(values, i), context.tbaa_frame_value);
+        storeValue<PyObject *>(item, getPointer<PyObject *>(items, i), context.tbaa_obj_field);
+    }
+    emitGcTrack(op);
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_helper);
+    auto built = callSymbol<handle_BUILD_TUPLE>(values, asValue<Py_ssize_t>(oparg));
+    auto b_helper_end = builder.GetInsertBlock();
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_end);
+    auto res = builder.CreatePHI(context.type<PyObject *>(), 2);
+    res->addIncoming(op, b_pop);
+    res->addIncoming(built, b_helper_end);
+    do_PUSH(res);
+}
+
+void CompileUnit::emit_BUILD_LIST(PyOparg oparg) {
+    auto values = do_POP_N(oparg);
+    auto &state = PyInterpreterState_Get()->list;
+    auto b_alloc = appendBlock("BUILD_LIST.alloc");
+    auto b_pop = appendBlock("BUILD_LIST.pop");
+    auto b_helper = appendBlock("BUILD_LIST.helper");
+    auto b_end = appendBlock("BUILD_LIST.end");
+    auto numfree_ptr = asPointer(&state.numfree);
+    auto numfree = loadValue<int>(numfree_ptr, context.tbaa_allocator);
+    auto can_pop = builder.CreateAnd(builder.CreateICmpNE(numfree, asValue(0)),
+            builder.CreateNot(isAllocationTraced()));
+    builder.CreateCondBr(can_pop, b_alloc, b_helper, context.likely_true);
+    builder.SetInsertPoint(b_alloc);
+    // the item array is allocated first, so a failure leaves the list in the freelist for the helper to report
+    Value *items = context.c_null;
+    if (oparg) {
+        items = callSymbol<PyMem_Malloc>(asValue<size_t>(oparg * sizeof(PyObject *)));
+        builder.CreateCondBr(builder.CreateICmpNE(items, context.c_null), b_pop, b_helper, context.likely_true);
+    } else {
+        builder.CreateBr(b_pop);
+    }
+    builder.SetInsertPoint(b_pop);
+    auto new_numfree = builder.CreateSub(numfree, asValue(1));
+    storeValue<int>(new_numfree, numfree_ptr, context.tbaa_allocator);
+    auto op = loadElementValue<PyObject *>(asPointer(state.free_list), new_numfree, context.tbaa_allocator);
+    initNewReference(op);
+    storeFiledValue(items, op, &PyListObject::ob_item, context.tbaa_obj_field);
+    storeFiledValue(asValue<Py_ssize_t>(oparg), op, &PyVarObject::ob_size, context.tbaa_obj_field);
+    storeFiledValue(asValue<Py_ssize_t>(oparg), op, &PyListObject::allocated, context.tbaa_obj_field);
+    for (auto i : IntRange(oparg)) {
+        auto item = loadValue<PyObject *>(getPointer<PyObject *>(values, i), context.tbaa_frame_value);
+        storeValue<PyObject *>(item, getPointer<PyObject *>(items, i), context.tbaa_obj_field);
+    }
+    emitGcTrack(op);
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_helper);
+    auto built = callSymbol<handle_BUILD_LIST>(values, asValue<Py_ssize_t>(oparg));
+    auto b_helper_end = builder.GetInsertBlock();
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_end);
+    auto res = builder.CreatePHI(context.type<PyObject *>(), 2);
+    res->addIncoming(op, b_pop);
+    res->addIncoming(built, b_helper_end);
+    do_PUSH(res);
+}
+
+BasicBlock *CompileUnit::emitArithmeticFastPath(Value *left, Value *right,
+        SmallVectorImpl<pair<Value *, BasicBlock *>> &results) {
+    // only emitted for a site which has only seen two floats or two ints
+    auto seen = monomorphicTypes();
+    if (!seen || seen->left != seen->right || (seen->left != &PyFloat_Type && seen->left != &PyLong_Type)) {
+        return nullptr;
+    }
+    Instruction::BinaryOps float_op, int_op;
+    switch ((PyInstrPointer{py_code} + emitting_vpc).opcode()) {
+    case BINARY_ADD:
+    case INPLACE_ADD:
+        float_op = Instruction::FAdd;
+        int_op = Instruction::Add;
+        break;
+    case BINARY_SUBTRACT:
+    case INPLACE_SUBTRACT:
+        float_op = Instruction::FSub;
+        int_op = Instruction::Sub;
+        break;
+    case BINARY_MULTIPLY:
+    case INPLACE_MULTIPLY:
+        float_op = Instruction::FMul;
+        int_op = Instruction::Mul;
+        break;
+    default:
+        return nullptr;
+    }
+    auto b_slow = appendBlock("BINARY_OP.slow");
+    auto b_end = appendBlock("BINARY_OP.end");
+    Value *res;
+    if (seen->left == &PyFloat_Type) {
+        auto b_float = appendBlock("BINARY_OP.float");
+        auto left_type = loadFieldValue(left, &PyObject::ob_type, context.tbaa_obj_field);
+        auto right_type = loadFieldValue(right, &PyObject::ob_type, context.tbaa_obj_field);
+        auto is_float = builder.CreateAnd(isExactType<PyFloat_Type>(left_type), isExactType<PyFloat_Type>(right_type));
+        builder.CreateCondBr(is_float, b_float, b_slow, context.likely_true);
+        builder.SetInsertPoint(b_float);
+        auto left_value = loadFieldValue(left, &PyFloatObject::ob_fval, context.tbaa_obj_field);
+        auto right_value = loadFieldValue(right, &PyFloatObject::ob_fval, context.tbaa_obj_field);
+        res = emitBoxFloat(builder.CreateBinOp(float_op, left_value, right_value));
+    } else {
+        // the product of two one-digit ints does not overflow either
+        auto left_value = loadSmallInt(left, b_slow);
+        auto right_value = loadSmallInt(right, b_slow);
+        res = callSymbol<boxInt>(builder.CreateBinOp(int_op, left_value, right_value));
+    }
+    results.emplace_back(res, builder.GetInsertBlock());
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_slow);
+    return b_end;
+}
+
+void CompileUnit::emitCondition(Value *cond, bool is_fused) {
+    if (is_fused) {
+        fused_condition = cond;
+        return;
+    }
+    auto py_true = getSymbol(searchSymbol<_Py_TrueStruct>());
+    auto py_false = getSymbol(searchSymbol<_Py_FalseStruct>());
+    auto value = builder.CreateSelect(cond, py_true, py_false);
+    do_Py_INCREF(value);
+    do_PUSH(value);
+}
+
+static bool isSmallInt(PyObject *o) {
+    return o && PyLong_CheckExact(o) && Py_ABS(Py_SIZE(o)) <= 1;
+}
+
+void CompileUnit::emit_COMPARE_OP(PyOparg oparg, bool is_fused) {
+    static constexpr CmpInst::Predicate int_predicates[]{
+            CmpInst::ICMP_SLT, CmpInst::ICMP_SLE, CmpInst::ICMP_EQ,
+            CmpInst::ICMP_NE, CmpInst::ICMP_SGT, CmpInst::ICMP_SGE
+    };
+    // NaN compares unequal to everything, including itself
+    static constexpr CmpInst::Predicate float_predicates[]{
+            CmpInst::FCMP_OLT, CmpInst::FCMP_OLE, CmpInst::FCMP_OEQ,
+            CmpInst::FCMP_UNE, CmpInst::FCMP_OGT, CmpInst::FCMP_OGE
+    };
+    auto const_right = fetchStackConstant(1);
+    auto const_left = fetchStackConstant(2);
+    auto right = do_POP();
+    auto left = do_POP();
+
+    auto b_slow = appendBlock("COMPARE_OP.slow");
+    auto b_fast_end = appendBlock("COMPARE_OP.fast_end");
+    SmallVector<pair<Value *, BasicBlock *>, 4> results;
+    auto has_const = const_left || const_right;
+    auto is_const_of = [&](auto check) { return (const_left && check(const_left)) || (const_right && check(const_right)); };
+    auto is_equality = oparg == Py_EQ || oparg == Py_NE;
+
+    auto try_int = !has_const || ((!const_left || isSmallInt(const_left)) && (!const_right || isSmallInt(const_right)));
+    auto try_float = !has_const || is_const_of([](PyObject *o) { return PyFloat_CheckExact(o); });
+    auto try_str = is_equality && (!has_const || is_const_of([](PyObject *o) { return PyUnicode_CheckExact(o); }));
+    recordOperandTypes(left, right);
+    if (auto seen = monomorphicTypes()) {
+        auto seen_both = [&](PyTypeObject &type) { return seen->left == &type && seen->right == &type; };
+        try_int &= seen_both(PyLong_Type);
+        try_float &= seen_both(PyFloat_Type);
+        try_str &= seen_both(PyUnicode_Type);
+    }
+
+    auto left_type = loadFieldValue(left, &PyObject::ob_type, context.tbaa_obj_field);
+    auto right_type = loadFieldValue(right, &PyObject::ob_type, context.tbaa_obj_field);
+    if (try_int) {
+        auto b_not_int = try_float || try_str ? appendBlock("COMPARE_OP.not_int") : b_slow;
+        auto load_int = [&](PyObject *const_value, Value *value) {
+            return const_value ? asValue<Py_ssize_t>(PyLong_AsSsize_t(const_value)) : loadSmallInt(value, b_not_int);
+        };
+        auto left_value = load_int(const_left, left);
+        auto right_value = load_int(const_right, right);
+        results.emplace_back(builder.CreateICmp(int_predicates[oparg], left_value, right_value),
+                builder.GetInsertBlock());
+        builder.CreateBr(b_fast_end);
+        builder.SetInsertPoint(b_not_int);
+    }
+    if (try_float) {
+        auto b_float = appendBlock("COMPARE_OP.float");
+        auto b_not_float = try_str ? appendBlock("COMPARE_OP.not_float") : b_slow;
+        auto is_float = builder.CreateAnd(isExactType<PyFloat_Type>(left_type), isExactType<PyFloat_Type>(right_type));
+        builder.CreateCondBr(is_float, b_float, b_not_float);
+        builder.SetInsertPoint(b_float);
+        auto left_value = loadFieldValue(left, &PyFloatObject::ob_fval, context.tbaa_obj_field);
+        auto right_value = loadFieldValue(right, &PyFloatObject::ob_fval, context.tbaa_obj_field);
+        results.emplace_back(builder.CreateFCmp(float_predicates[oparg], left_value, right_value),
+                builder.GetInsertBlock());
+        builder.CreateBr(b_fast_end);
+        builder.SetInsertPoint(b_not_float);
+    }
+    if (try_str) {
+        auto b_str = appendBlock("COMPARE_OP.str");
+        auto b_str_compare = appendBlock("COMPARE_OP.str_compare");
+        auto is_str = builder.CreateAnd(isExactType<PyUnicode_Type>(left_type), isExactType<PyUnicode_Type>(right_type));
+        builder.CreateCondBr(is_str, b_str, b_slow);
+        builder.SetInsertPoint(b_str);
+        results.emplace_back(asValue<bool>(oparg == Py_EQ), b_str);
+        builder.CreateCondBr(builder.CreateICmpEQ(left, right), b_fast_end, b_str_compare);
+        builder.SetInsertPoint(b_str_compare);
+        auto str_eq = callSymbol<_PyUnicode_EQ, &Context::attr_frameless_call>(left, right);
+        auto is_equal = builder.CreateICmpNE(str_eq, asValue(0));
+        results.emplace_back(oparg == Py_EQ ? is_equal : builder.CreateNot(is_equal), builder.GetInsertBlock());
+        builder.CreateBr(b_fast_end);
+    } else if (!try_int && !try_float) {
+        builder.CreateBr(b_slow);
+    }
+
+    auto b_end = appendBlock("COMPARE_OP.end");
+    builder.SetInsertPoint(b_fast_end);
+    auto fast_result = builder.CreatePHI(builder.getInt1Ty(), results.size());
+    for (auto &[v, b] : results) {
+        fast_result->addIncoming(v, b);
+    }
+    if (is_fused) {
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_slow);
+        auto slow_result = callSymbol<handle_COMPARE_OP_BOOL>(left, right, asValue<int>(oparg));
+        auto b_slow_end = builder.GetInsertBlock();
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_end);
+        auto result = builder.CreatePHI(builder.getInt1Ty(), 2);
+        result->addIncoming(fast_result, b_fast_end);
+        result->addIncoming(slow_result, b_slow_end);
+        do_Py_DECREF(left);
+        do_Py_DECREF(right);
+        emitCondition(result, true);
+    } else {
+        auto py_true = getSymbol(searchSymbol<_Py_TrueStruct>());
+        auto py_false = getSymbol(searchSymbol<_Py_FalseStruct>());
+        auto fast_object = builder.CreateSelect(fast_result, py_true, py_false);
+        do_Py_INCREF(fast_object);
+        auto b_fast_incref_end = builder.GetInsertBlock();
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_slow);
+        auto slow_object = callSymbol<handle_COMPARE_OP>(left, right, asValue<int>(oparg));
+        auto b_slow_end = builder.GetInsertBlock();
+        builder.CreateBr(b_end);
+        builder.SetInsertPoint(b_end);
+        auto result = builder.CreatePHI(context.type<PyObject *>(), 2);
+        result->addIncoming(fast_object, b_fast_incref_end);
+        result->addIncoming(slow_object, b_slow_end);
+        do_Py_DECREF(left);
+        do_Py_DECREF(right);
+        do_PUSH(result);
+    }
+}
+
+bool CompileUnit::emitConstantProbe(PyObject *const_container, Value *container, Value *item,
+        BasicBlock *b_slow, BasicBlock *b_end, SmallVectorImpl<pair<Value *, BasicBlock *>> &results) {
+    // each element of the constant with the byte offset of its slot from the base
+    constexpr size_t max_probed_elements = 8;
+    SmallVector<pair<PyObject *, ptrdiff_t>, max_probed_elements> elements;
+    bool is_tuple = PyTuple_CheckExact(const_container);
+    if (is_tuple) {
+        for (auto i : IntRange(PyTuple_GET_SIZE(const_container))) {
+            auto offset = offsetof(PyTupleObject, ob_item) + i * sizeof(PyObject *);
+            elements.emplace_back(PyTuple_GET_ITEM(const_container, i), offset);
+        }
+    } else if (PyFrozenSet_CheckExact(const_container)) {
+        auto set = reinterpret_cast<PySetObject *>(const_container);
+        for (auto i : IntRange(set->mask + 1)) {
+            if (set->table[i].key) {
+                elements.emplace_back(set->table[i].key, i * sizeof(setentry) + offsetof(setentry, key));
+            }
+        }
+    }
+    if (elements.empty() || elements.size() > max_probed_elements) {
+        return false;
+    }
+    bool all_str = true;
+    bool all_small_int = true;
+    for (auto [e, offset] : elements) {
+        all_str &= PyUnicode_CheckExact(e) && PyUnicode_IS_READY(e);
+        all_small_int &= PyLong_CheckExact(e) && Py_ABS(Py_SIZE(e)) <= 1;
+    }
+    if (!all_str && !all_small_int) {
+        return false;
+    }
+
+    auto b_found = appendBlock("CONTAINS_OP.found");
+    auto b_not_found = appendBlock("CONTAINS_OP.not_found");
+    auto item_type = loadFieldValue(item, &PyObject::ob_type, context.tbaa_obj_field);
+    if (all_str) {
+        auto b_str = appendBlock("CONTAINS_OP.str");
+        auto b_hashed = appendBlock("CONTAINS_OP.hashed");
+        builder.CreateCondBr(isExactType<PyUnicode_Type>(item_type), b_str, b_slow, context.likely_true);
+        builder.SetInsertPoint(b_str);
+        auto hash = loadFieldValue(item, &PyASCIIObject::hash, context.tbaa_obj_field);
+        builder.CreateCondBr(builder.CreateICmpEQ(hash, asValue<Py_hash_t>(-1)), b_slow, b_hashed);
+        builder.SetInsertPoint(b_hashed);
+        auto base = is_tuple ? container : loadFieldValue(container, &PySetObject::table, context.tbaa_obj_field);
+        for (auto [e, offset] : elements) {
+            auto b_same_hash = appendBlock("CONTAINS_OP.same_hash");
+            auto b_compare = appendBlock("CONTAINS_OP.compare");
+            auto b_next = appendBlock("CONTAINS_OP.next");
+            builder.CreateCondBr(builder.CreateICmpEQ(hash, asValue(PyObject_Hash(e))), b_same_hash, b_next);
+            builder.SetInsertPoint(b_same_hash);
+            auto element = loadValue<PyObject *>(getPointer<char>(base, offset), context.tbaa_obj_field);
+            builder.CreateCondBr(builder.CreateICmpEQ(item, element), b_found, b_compare);
+            builder.SetInsertPoint(b_compare);
+            auto is_equal = callSymbol<_PyUnicode_EQ, &Context::attr_frameless_call>(item, element);
+            builder.CreateCondBr(builder.CreateICmpNE(is_equal, asValue(0)), b_found, b_next);
+            builder.SetInsertPoint(b_next);
+        }
+    } else {
+        auto value = loadSmallInt(item, b_slow);
+        for (auto [e, offset] : elements) {
+            auto b_next = appendBlock("CONTAINS_OP.next");
+            auto e_value = asValue<Py_ssize_t>(PyLong_AsSsize_t(e));
+            builder.CreateCondBr(builder.CreateICmpEQ(value, e_value), b_found, b_next);
+            builder.SetInsertPoint(b_next);
+        }
+    }
+    builder.CreateBr(b_not_found);
+    builder.SetInsertPoint(b_found);
+    builder.CreateBr(b_end);
+    builder.SetInsertPoint(b_not_found);
+    builder.CreateBr(b_end);
+    results.emplace_back(builder.getTrue(), b_found);
+    results.emplace_back(builder.getFalse(), b_not_found);
+    return true;
+}
+
+void CompileUnit::emit_CONTAINS_OP(PyOparg oparg, bool is_fused) {
+    auto const_container = fetchStackConstant(1);
+    auto const_item = fetchStackConstant(2);
+    auto container = do_POP();
+    auto item = do_POP();
+
+    Value *found;
+    auto folded = const_container && const_item ? PySequence_Contains(const_container, const_item) : -1;
+    if (folded >= 0) {
+        found = asValue<bool>(folded);
+    } else {
+        PyErr_Clear();
+        auto b_slow = appendBlock("CONTAINS_OP.slow");
+        auto b_end = appendBlock("CONTAINS_OP.end");
+        SmallVector<pair<Value *, BasicBlock *>, 4> results;
+        if (const_container) {
+            if (PyUnicode_CheckExact(const_container)) {
+                results.emplace_back(callSymbol<handle_CONTAINS_OP_STR>(container, item), builder.GetInsertBlock());
+                builder.CreateBr(b_end);
+            } else if (!emitConstantProbe(const_container, container, item, b_slow, b_end, results)) {
+                builder.CreateBr(b_slow);
+            }
+        } else {
+            auto b_set = appendBlock("CONTAINS_OP.set");
+            auto b_not_set = appendBlock("CONTAINS_OP.not_set");
+            auto b_dict = appendBlock("CONTAINS_OP.dict");
+            auto b_not_dict = appendBlock("CONTAINS_OP.not_dict");
+            auto b_str = appendBlock("CONTAINS_OP.str");
+            auto container_type = loadFieldValue(container, &PyObject::ob_type, context.tbaa_obj_field);
+            auto is_set = builder.CreateOr(isExactType<PySet_Type>(container_type),
+                    isExactType<PyFrozenSet_Type>(container_type));
+            builder.CreateCondBr(is_set, b_set, b_not_set);
+            builder.SetInsertPoint(b_set);
+            results.emplace_back(callSymbol<handle_CONTAINS_OP_SET>(container, item), builder.GetInsertBlock());
+            builder.CreateBr(b_end);
+
+            builder.SetInsertPoint(b_not_set);
+            builder.CreateCondBr(isExactType<PyDict_Type>(container_type), b_dict, b_not_dict);
+            builder.SetInsertPoint(b_dict);
+            auto hash = asValue(hashConstant(const_item));
+            results.emplace_back(callSymbol<handle_CONTAINS_OP_DICT>(container, item, hash), builder.GetInsertBlock());
+            builder.CreateBr(b_end);
+
+            builder.SetInsertPoint(b_not_dict);
+            builder.CreateCondBr(isExactType<PyUnicode_Type>(container_type), b_str, b_slow);
+            builder.SetInsertPoint(b_str);
+            results.emplace_back(callSymbol<handle_CONTAINS_OP_STR>(container, item), builder.GetInsertBlock());
+            builder.CreateBr(b_end);
+        }
+
+        builder.SetInsertPoint(b_slow);
+        results.emplace_back(callSymbol<handle_CONTAINS_OP>(container, item), builder.GetInsertBlock());
+        builder.CreateBr(b_end);
+
+        builder.SetInsertPoint(b_end);
+        auto phi = builder.CreatePHI(builder.getInt1Ty(), results.size());
+        for (auto &[v, b] : results) {
+            phi->addIncoming(v, b);
+        }
+        found = phi;
+    }
+
+    do_Py_DECREF(container);
+    do_Py_DECREF(item);
+    emitCondition(oparg ? builder.CreateNot(found) : found, is_fused);
+}
+
+void CompileUnit::emit_UNPACK_SEQUENCE(PyOparg oparg) {
+    constexpr PyOparg max_inline_unpack = 8;
+    auto seq = do_POP();
+    if (oparg > max_inline_unpack) {
+        callSymbol<handle_UNPACK_SEQUENCE>(seq, asValue<Py_ssize_t>(oparg), getStackSlot());
+        do_Py_DECREF(seq);
+        declareStackGrowth(oparg);
+        return;
+    }
+
+    auto b_tuple = appendBlock("UNPACK_SEQUENCE.tuple");
+    auto b_not_tuple = appendBlock("UNPACK_SEQUENCE.not_tuple");
+    auto b_list = appendBlock("UNPACK_SEQUENCE.list");
+    auto b_sequence = appendBlock("UNPACK_SEQUENCE.sequence");
+    auto b_fast = appendBlock("UNPACK_SEQUENCE.fast");
+    auto b_slow = appendBlock("UNPACK_SEQUENCE.slow");
+    auto b_end = appendBlock("UNPACK_SEQUENCE.end");
+    auto seq_type = loadFieldValue(seq, &PyObject::ob_type, context.tbaa_obj_field);
+    builder.CreateCondBr(isExactType<PyTuple_Type>(seq_type), b_tuple, b_not_tuple);
+    builder.SetInsertPoint(b_tuple);
+    auto tuple_items = getPointer(seq, &PyTupleObject::ob_item);
+    builder.CreateBr(b_sequence);
+    builder.SetInsertPoint(b_not_tuple);
+    builder.CreateCondBr(isExactType<PyList_Type>(seq_type), b_list, b_slow);
+    builder.SetInsertPoint(b_list);
+    auto list_items = loadFieldValue(seq, &PyListObject::ob_item, context.tbaa_obj_field);
+    builder.CreateBr(b_sequence);
+
+    builder.SetInsertPoint(b_sequence);
+    auto items = builder.CreatePHI(context.type<PyObject **>(), 2);
+    items->addIncoming(tuple_items, b_tuple);
+    items->addIncoming(list_items, b_list);
+    auto size = loadFieldValue(seq, &PyVarObject::ob_size, context.tbaa_obj_field);
+    builder.CreateCondBr(builder.CreateICmpEQ(size, asValue<Py_ssize_t>(oparg)), b_fast, b_slow, context.likely_true);
+
+    // the last item goes deepest into the stack
+    SmallVector<PHINode *, max_inline_unpack> values;
+    builder.SetInsertPoint(b_end);
+    for ([[maybe_unused]] auto i : IntRange(oparg)) {
+        values.push_back(builder.CreatePHI(context.type<PyObject *>(), 2));
+    }
+
+    builder.SetInsertPoint(b_fast);
+    for (auto i : IntRange(oparg)) {
+        auto item = loadValue<PyObject *>(getPointer<PyObject *>(items, oparg - 1 - i), context.tbaa_obj_field);
+        do_Py_INCREF(item);
+        values[i]->addIncoming(item, b_fast);
+    }
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_slow);
+    callSymbol<handle_UNPACK_SEQUENCE>(seq, asValue<Py_ssize_t>(oparg), getStackSlot());
+    for (auto i : IntRange(oparg)) {
+        auto item = loadValue<PyObject *>(getStackSlot(-i), context.tbaa_frame_value);
+        values[i]->addIncoming(item, builder.GetInsertBlock());
+    }
+    builder.CreateBr(b_end);
+
+    builder.SetInsertPoint(b_end);
+    do_Py_DECREF(seq);
+    for (auto value : values) {
+        do_PUSH(value);
+    }
+}
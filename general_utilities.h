@@ -1,9 +1,13 @@
 #ifndef PYNIC_GENERAL_UTILITIES
 #define PYNIC_GENERAL_UTILITIES
 
+#include <algorithm>
 #include <exception>
+#include <memory>
+#include <new>
 #include <string>
 #include <type_traits>
+#include <utility>
 
 #include <Python.h>
 #include <opcode.h>
@@ -109,23 +113,95 @@ public:
     auto end() { return Iterator{to}; }
 };
 
+// bytes ever reserved by DynamicArray, lets the analysis benchmark see the front end's memory use
+inline size_t dynamic_array_allocated_bytes = 0;
+
+// memory for data living no longer than one compilation, released all at once by reset()
+class BumpArena {
+    struct Chunk {
+        Chunk *previous;
+        size_t size;
+    };
+
+    static constexpr size_t min_chunk_size = 64 * 1024;
+
+    Chunk *chunk{};
+    char *cursor{};
+    char *limit{};
+
+    void grow(size_t bytes) {
+        auto size = std::max({min_chunk_size, chunk ? 2 * chunk->size : 0, bytes + sizeof(Chunk)});
+        auto new_chunk = static_cast<Chunk *>(::operator new(size));
+        *new_chunk = {chunk, size};
+        chunk = new_chunk;
+        cursor = reinterpret_cast<char *>(chunk + 1);
+        limit = reinterpret_cast<char *>(chunk) + size;
+    }
+
+public:
+    BumpArena() = default;
+    BumpArena(const BumpArena &) = delete;
+
+    ~BumpArena() {
+        while (chunk) {
+            ::operator delete(std::exchange(chunk, chunk->previous));
+        }
+    }
+
+    void *allocate(size_t bytes, size_t alignment) {
+        auto space = static_cast<size_t>(limit - cursor);
+        void *p = cursor;
+        if (!cursor || !std::align(alignment, bytes, p, space)) {
+            grow(bytes + alignment);
+            p = cursor;
+            space = limit - cursor;
+            std::align(alignment, bytes, p, space);
+        }
+        cursor = static_cast<char *>(p) + bytes;
+        return p;
+    }
+
+    // keep only the latest and largest chunk, the next compilation mostly fits in it
+    void reset() {
+        if (chunk) {
+            while (auto previous = chunk->previous) {
+                chunk->previous = previous->previous;
+                ::operator delete(previous);
+            }
+            cursor = reinterpret_cast<char *>(chunk + 1);
+        }
+    }
+
+    class Scope {
+        BumpArena &arena;
+    public:
+        explicit Scope(BumpArena &arena) : arena{arena} {}
+
+        ~Scope() { arena.reset(); }
+    };
+};
+
 template <typename T>
 class DynamicArray {
 protected:
     T *data{};
+    bool in_arena{false};
     IF_DEBUG(size_t array_size;)
 
 public:
     DynamicArray() = default;
 
-    DynamicArray(DynamicArray &&other) noexcept: data{other.data} {
+    DynamicArray(DynamicArray &&other) noexcept: data{other.data}, in_arena{other.in_arena} {
         other.data = nullptr;
     };
 
     explicit DynamicArray(size_t size) { reserve(size); };
 
+    DynamicArray(BumpArena &arena, size_t size) { reserve(arena, size); };
+
     ~DynamicArray() {
-        if (data) {
+        // elements in an arena are not destroyed, so they must not own anything outside of it
+        if (data && !in_arena) {
             delete[] data;
         }
     };
@@ -133,6 +209,18 @@ public:
     void reserve(size_t size) {
         assert(!data);
         data = new T[size];
+        dynamic_array_allocated_bytes += size * sizeof(T);
+        IF_DEBUG(array_size = size;)
+    }
+
+    void reserve(BumpArena &arena, size_t size) {
+        assert(!data);
+        data = static_cast<T *>(arena.allocate(size * sizeof(T), alignof(T)));
+        for (auto i = size; i--;) {
+            new(data + i) T;
+        }
+        in_arena = true;
+        dynamic_array_allocated_bytes += size * sizeof(T);
         IF_DEBUG(array_size = size;)
     }
 
@@ -149,6 +237,8 @@ public:
     }
 
     const auto &operator[](size_t index) const { return data[index]; }
+
+    const T *getPointer(size_t index = 0) const { return data + index; }
 };
 
 
@@ -164,6 +254,11 @@ public:
         stack_pointer = &storage_space[0];
     }
 
+    void reserve(BumpArena &arena, size_t size) {
+        storage_space.reserve(arena, size);
+        stack_pointer = &storage_space[0];
+    }
+
     auto empty() {
         return stack_pointer == &storage_space[0];
     }
@@ -192,6 +287,10 @@ public:
         fill(size, fill_with);
     }
 
+    BitArray(BumpArena &arena, size_t size, bool fill_with = false) : Parent(arena, chunkNumber(size)) {
+        fill(size, fill_with);
+    }
+
     auto &getChunk(size_t index) { return Parent::operator[](index); }
 
     const auto &getChunk(size_t index) const { return Parent::operator[](index); }
@@ -201,6 +300,11 @@ public:
         fill(size, fill_with);
     }
 
+    void reserve(BumpArena &arena, size_t size, bool fill_with = false) {
+        Parent::reserve(arena, chunkNumber(size));
+        fill(size, fill_with);
+    }
+
     bool checkAndSet(size_t index) {
         auto &chunk = data[index / bits_per_chunk];
         auto tester = ChunkType{1} << index % bits_per_chunk;
@@ -221,7 +325,7 @@ public:
         setIf(index, true);
     }
 
-    bool get(size_t index) {
+    bool get(size_t index) const {
         return data[index / bits_per_chunk] & (ChunkType{1} << index % bits_per_chunk);
     }
 
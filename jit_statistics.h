@@ -0,0 +1,109 @@
+#ifndef PYNIC_JIT_STATISTICS
+#define PYNIC_JIT_STATISTICS
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <string>
+
+// process-wide counters, add new kinds (e.g. cache or guard events) before counter_kind_num
+enum JitCounter {
+    counter_compilations,
+    counter_compile_failures,
+    counter_compile_ns,
+    counter_code_bytes,
+    counter_metadata_bytes,
+    counter_evictions,
+    counter_calls,
+    counter_interpreter_exits,
+    counter_tracing_fallbacks,
+    counter_kind_num
+};
+
+constexpr const char *jit_counter_names[counter_kind_num]{
+        "compilations",
+        "compile_failures",
+        "compile_ns",
+        "code_bytes",
+        "metadata_bytes",
+        "evictions",
+        "calls",
+        "interpreter_exits",
+        "tracing_fallbacks"
+};
+
+enum JitEventKind : char {
+    event_compiled,
+    event_compile_failed,
+    event_freed,
+    event_evicted,
+    event_stats_toggled,
+    event_kind_num
+};
+
+constexpr const char *jit_event_names[event_kind_num]{
+        "compiled",
+        "compile_failed",
+        "freed",
+        "evicted",
+        "stats_toggled"
+};
+
+struct JitEvent {
+    long long timestamp; // nanoseconds of the steady clock
+    JitEventKind kind;
+    long long value;     // code bytes for compiled/freed/evicted, nanoseconds of a failed compilation
+    char subject[64];    // qualified name of the function
+    char detail[64];     // reason of a failure
+};
+
+class JitStatistics {
+public:
+    static constexpr size_t event_capacity = 256;
+
+    // whether code compiled from now on counts its calls of helper functions
+    bool count_helper_calls = false;
+    unsigned long long counters[counter_kind_num]{};
+    std::map<std::string, unsigned long long> failure_reasons{};
+
+private:
+    std::array<JitEvent, event_capacity> events{};
+    size_t event_num = 0;
+
+public:
+    void record(JitEventKind kind, long long value, const char *subject, const char *detail = "") {
+        auto &e = events[event_num++ % event_capacity];
+        e.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        e.kind = kind;
+        e.value = value;
+        strncpy(e.subject, subject, sizeof(e.subject) - 1);
+        e.subject[sizeof(e.subject) - 1] = '\0';
+        strncpy(e.detail, detail, sizeof(e.detail) - 1);
+        e.detail[sizeof(e.detail) - 1] = '\0';
+    }
+
+    // visit the retained events from the oldest one
+    void forEachEvent(auto &&visit) const {
+        auto first = event_num > event_capacity ? event_num - event_capacity : 0;
+        for (auto i = first; i < event_num; ++i) {
+            visit(events[i % event_capacity]);
+        }
+    }
+
+    void reset() {
+        // the code which is still loaded is not forgotten
+        auto code_bytes = counters[counter_code_bytes];
+        auto metadata_bytes = counters[counter_metadata_bytes];
+        std::fill(std::begin(counters), std::end(counters), 0);
+        counters[counter_code_bytes] = code_bytes;
+        counters[counter_metadata_bytes] = metadata_bytes;
+        failure_reasons.clear();
+        event_num = 0;
+    }
+};
+
+extern JitStatistics jit_statistics;
+
+#endif
@@ -1,12 +1,31 @@
+#include <unordered_set>
+
 #include <Python.h>
 #include <internal/pycore_pyerrors.h>
 
 #include "compile_unit.h"
+#include "jit_statistics.h"
 
 using namespace std;
 
 static unique_ptr<Translator> translator;
 static Py_ssize_t code_extra_index;
+// the results whose code is loaded, the least recently executed ones are evicted to stay in the budget
+static unordered_set<CompileUnit::TranslatedResult *> resident_results;
+static size_t memory_budget = 0;
+static unsigned long long call_clock = 0;
+
+static void deleteResult(CompileUnit::TranslatedResult *result) {
+    jit_statistics.counters[counter_metadata_bytes] -= result->metadata_bytes;
+    if (!result->evicted) {
+        jit_statistics.counters[counter_code_bytes] -= result->code_bytes;
+        jit_statistics.record(event_freed, result->code_bytes, "");
+        unloadCode(result->mem_block);
+        resident_results.erase(result);
+    }
+    Py_XDECREF(result->interpreter_code);
+    delete result;
+}
 
 
 PyObject *eval_func(PyThreadState *tstate, PyFrameObject *f, int throwflag) {
@@ -20,15 +39,47 @@ PyObject *eval_func(PyThreadState *tstate, PyFrameObject *f, int throwflag) {
     if (!compiled_result) {
         return _PyEval_EvalFrameDefault(tstate, f, throwflag);
     }
+    if (f->f_lasti >= 0 && f->f_blockstack[CO_MAXBLOCKS - 1].b_handler == resume_in_interpreter) {
+        // the frame left the compiled code before it was suspended
+        return _PyEval_EvalFrameDefault(tstate, f, throwflag);
+    }
+    if (tstate->cframe->use_tracing || compiled_result->evicted) [[unlikely]] {
+        // let the interpreter emit the trace and profile events, new frames use the compiled code again once it is off,
+        // or run the evicted code until the function is compiled again
+        if (!compiled_result->evicted) {
+            jit_statistics.counters[counter_tracing_fallbacks]++;
+        }
+        if (f->f_lasti >= 0) {
+            // suspended at a yield, the interpreter continues after it, or retries YIELD_FROM as it would itself
+            auto vpc = f->f_lasti;
+            if ((PyInstrPointer{f->f_code} + vpc).opcode() != YIELD_FROM) {
+                vpc++;
+            }
+            VpcMap region_map{compiled_result->region_ranges.getPointer(), compiled_result->region_range_num};
+            restoreBlockStack(f, compiled_result->try_regions.getPointer(), region_map, vpc);
+            f->f_lasti = vpc - 1;
+        } else {
+            // a generator started here is resumed in the interpreter as well
+            f->f_blockstack[CO_MAXBLOCKS - 1].b_handler = resume_in_interpreter;
+        }
+        return _PyEval_EvalFrameDefault(tstate, f, throwflag);
+    }
     // TODO: support generator and throwflag
     assert(!throwflag);
 
+    compiled_result->calls++;
+    compiled_result->last_call = ++call_clock;
+    compiled_result->active_frames++;
+    jit_statistics.counters[counter_calls]++;
 
     f->f_state = FRAME_EXECUTING;
 
     auto prev_cframe = tstate->cframe;
     ExtendedCFrame cframe;
-    cframe.sp_map = compiled_result->sp_map.getPointer();
+    cframe.sp_map = {compiled_result->sp_ranges.getPointer(), compiled_result->sp_range_num};
+    cframe.try_regions = compiled_result->try_regions.getPointer();
+    cframe.region_map = {compiled_result->region_ranges.getPointer(), compiled_result->region_range_num};
+    cframe.interpreter_code = compiled_result->interpreter_code;
     cframe.use_tracing = prev_cframe->use_tracing;
     cframe.previous = prev_cframe;
     tstate->cframe = &cframe;
@@ -46,35 +97,338 @@ PyObject *eval_func(PyThreadState *tstate, PyFrameObject *f, int throwflag) {
     assert(f->f_state == FRAME_SUSPENDED || f->f_stackdepth == 0);
     tstate->cframe = prev_cframe;
     tstate->frame = f->f_back;
+    if (!--compiled_result->active_frames && compiled_result->released) {
+        deleteResult(compiled_result);
+    }
     assert(!!result ^ !!_PyErr_Occurred(tstate));
     return result;
 }
 
 void freeExtra(void *result) {
     auto result_ = reinterpret_cast< CompileUnit::TranslatedResult *>(result);
-    unloadCode(result_->mem_block);
-    delete result_;
+    // the code object calls it for the slot emptied by an eviction as well
+    if (!result_) {
+        return;
+    }
+    if (result_->active_frames) {
+        // compiled again while running, the last frame leaving the code frees it
+        result_->released = true;
+        return;
+    }
+    deleteResult(result_);
+}
+
+static void evict(CompileUnit::TranslatedResult *result) {
+    jit_statistics.counters[counter_evictions]++;
+    jit_statistics.record(event_evicted, result->code_bytes,
+            PyStringAsString(reinterpret_cast<PyCodeObject *>(result->py_code)->co_name));
+    if (!(reinterpret_cast<PyCodeObject *>(result->py_code)->co_flags &
+            (CO_GENERATOR | CO_COROUTINE | CO_ASYNC_GENERATOR))) {
+        // no frame can be suspended in the code, so nothing needs the tables either
+        _PyCode_SetExtra(result->py_code, code_extra_index, nullptr);
+        return;
+    }
+    // the suspended frames resume in the interpreter, which needs the tables to restore their block stacks,
+    // their value stacks are already complete since the analysis keeps every value live across a yield in the frame
+    jit_statistics.counters[counter_code_bytes] -= result->code_bytes;
+    unloadCode(result->mem_block);
+    if (result->profile) {
+        auto profile_bytes = result->profile->allocatedBytes();
+        result->profile.reset();
+        result->metadata_bytes -= profile_bytes;
+        jit_statistics.counters[counter_metadata_bytes] -= profile_bytes;
+    }
+    result->evicted = true;
+    resident_results.erase(result);
+}
+
+// evict the least recently executed code until the bytes fit in the budget, the code being run is kept
+static bool makeRoom(size_t bytes) {
+    while (memory_budget && jit_statistics.counters[counter_code_bytes] +
+            jit_statistics.counters[counter_metadata_bytes] + bytes > memory_budget) {
+        CompileUnit::TranslatedResult *victim = nullptr;
+        for (auto result : resident_results) {
+            if (!result->active_frames && (!victim || result->last_call < victim->last_call)) {
+                victim = result;
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+        evict(victim);
+    }
+    return true;
 }
 
-PyObject *apply(PyObject *, PyObject *maybe_func) {
+PyObject *apply(PyObject *, PyObject *args, PyObject *kwargs) {
+    static const char *kwlist[] = {"", "loops_only", "profile", nullptr};
+    PyObject *maybe_func;
+    int loops_only = false;
+    int profiling = false;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$pp:apply", const_cast<char **>(kwlist),
+            &maybe_func, &loops_only, &profiling)) {
+        return nullptr;
+    }
     if (!PyFunction_Check(maybe_func)) {
         PyErr_SetString(PyExc_TypeError, "bad argument type");
         return nullptr;
     }
     auto func = reinterpret_cast<PyFunctionObject *>(maybe_func);
+    auto qualname = PyUnicode_AsUTF8(func->func_qualname);
+    if (!qualname) {
+        return nullptr;
+    }
+    auto start = chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    };
+    auto failed = [&](const char *reason) {
+        jit_statistics.counters[counter_compile_failures]++;
+        jit_statistics.failure_reasons[reason]++;
+        jit_statistics.record(event_compile_failed, elapsed(), qualname, reason);
+    };
+    CompileUnit::TranslatedResult *previous;
+    if (_PyCode_GetExtra(func->func_code, code_extra_index, reinterpret_cast<void **>(&previous)) == -1) {
+        return nullptr;
+    }
+    // compiling a profiled function again weights its branches by what the profile saw
+    auto feedback = previous ? previous->profile.get() : nullptr;
     CompileUnit::TranslatedResult *result;
     try {
-        result = CompileUnit::emit(*translator, func->func_code);
+        result = CompileUnit::emit(*translator, func->func_code, loops_only, profiling, feedback);
     } catch (runtime_error &err) {
+        failed(err.what());
         PyErr_SetString(PyExc_RuntimeError, err.what());
         return nullptr;
     } catch (bad_exception &) {
+        failed(PyErr_Occurred() ? Py_TYPE(PyErr_Occurred())->tp_name : "unknown");
+        return nullptr;
+    }
+    result->compile_ns = elapsed();
+    result->py_code = func->func_code;
+    if (!makeRoom(result->code_bytes + result->metadata_bytes)) {
+        // the function is left as it is
+        unloadCode(result->mem_block);
+        Py_XDECREF(result->interpreter_code);
+        delete result;
+        failed("memory budget exceeded");
+        PyErr_SetString(PyExc_MemoryError, "compiled code exceeds the memory budget");
         return nullptr;
     }
+    jit_statistics.counters[counter_compilations]++;
+    jit_statistics.counters[counter_compile_ns] += result->compile_ns;
+    jit_statistics.counters[counter_code_bytes] += result->code_bytes;
+    jit_statistics.counters[counter_metadata_bytes] += result->metadata_bytes;
+    jit_statistics.record(event_compiled, result->code_bytes, qualname);
     _PyCode_SetExtra(func->func_code, code_extra_index, result);
+    result->last_call = ++call_clock;
+    resident_results.insert(result);
     return Py_NewRef(func);
 }
 
+PyObject *analyze(PyObject *, PyObject *maybe_func) {
+    if (!PyFunction_Check(maybe_func)) {
+        PyErr_SetString(PyExc_TypeError, "bad argument type");
+        return nullptr;
+    }
+    auto func = reinterpret_cast<PyFunctionObject *>(maybe_func);
+    CompileUnit::AnalysisStatistics stats;
+    try {
+        stats = CompileUnit::analyze(*translator, func->func_code);
+    } catch (runtime_error &err) {
+        PyErr_SetString(PyExc_RuntimeError, err.what());
+        return nullptr;
+    } catch (bad_exception &) {
+        return nullptr;
+    }
+    return Py_BuildValue("{sLsLsLsLsnsIsIsI}",
+            "parse_cfg", stats.parse_cfg,
+            "intra_block", stats.intra_block,
+            "inter_block", stats.inter_block,
+            "try_regions", stats.try_regions,
+            "allocated_bytes", static_cast<Py_ssize_t>(stats.allocated_bytes),
+            "instr_num", stats.instr_num,
+            "block_num", stats.block_num,
+            "try_block_num", stats.try_block_num);
+}
+
+static bool setCount(PyObject *dict, const char *key, unsigned long long count) {
+    auto value = PyLong_FromUnsignedLongLong(count);
+    auto failed = !value || PyDict_SetItemString(dict, key, value);
+    Py_XDECREF(value);
+    return !failed;
+}
+
+PyObject *stats(PyObject *, PyObject *) {
+    auto dict = PyDict_New();
+    auto reasons = PyDict_New();
+    auto calls = PyDict_New();
+    auto ok = dict && reasons && calls;
+    for (auto i : IntRange<int>(counter_kind_num)) {
+        ok = ok && setCount(dict, jit_counter_names[i], jit_statistics.counters[i]);
+    }
+    for (auto &[reason, count] : jit_statistics.failure_reasons) {
+        ok = ok && setCount(reasons, reason.c_str(), count);
+    }
+    for (auto i : IntRange(external_symbol_count)) {
+        ok = ok && (!helper_calls[i] || setCount(calls, symbol_names[i], helper_calls[i]));
+    }
+    ok = ok && setCount(dict, "memory_budget", memory_budget);
+    ok = ok && !PyDict_SetItemString(dict, "failure_reasons", reasons)
+            && !PyDict_SetItemString(dict, "helper_calls", calls)
+            && !PyDict_SetItemString(dict, "count_helper_calls", jit_statistics.count_helper_calls ? Py_True : Py_False);
+    Py_XDECREF(reasons);
+    Py_XDECREF(calls);
+    if (!ok) {
+        Py_XDECREF(dict);
+        return nullptr;
+    }
+    return dict;
+}
+
+PyObject *function_stats(PyObject *, PyObject *maybe_func) {
+    if (!PyFunction_Check(maybe_func)) {
+        PyErr_SetString(PyExc_TypeError, "bad argument type");
+        return nullptr;
+    }
+    auto func = reinterpret_cast<PyFunctionObject *>(maybe_func);
+    CompileUnit::TranslatedResult *result;
+    if (_PyCode_GetExtra(func->func_code, code_extra_index, reinterpret_cast<void **>(&result)) == -1) {
+        return nullptr;
+    }
+    if (!result) {
+        Py_RETURN_NONE;
+    }
+    auto side_table_bytes = (result->sp_range_num + result->region_range_num) * sizeof(VpcRange);
+    return Py_BuildValue("{snsnsnsLsOsOsKsO}",
+            "code_bytes", static_cast<Py_ssize_t>(result->code_bytes),
+            "side_table_bytes", static_cast<Py_ssize_t>(side_table_bytes),
+            "metadata_bytes", static_cast<Py_ssize_t>(result->metadata_bytes),
+            "compile_ns", result->compile_ns,
+            "loops_only", result->loops_only ? Py_True : Py_False,
+            "profile_guided", result->profile_guided ? Py_True : Py_False,
+            "calls", result->calls,
+            "evicted", result->evicted ? Py_True : Py_False);
+}
+
+PyObject *block_profile(PyObject *, PyObject *maybe_func) {
+    if (!PyFunction_Check(maybe_func)) {
+        PyErr_SetString(PyExc_TypeError, "bad argument type");
+        return nullptr;
+    }
+    auto func = reinterpret_cast<PyFunctionObject *>(maybe_func);
+    CompileUnit::TranslatedResult *result;
+    if (_PyCode_GetExtra(func->func_code, code_extra_index, reinterpret_cast<void **>(&result)) == -1) {
+        return nullptr;
+    }
+    if (!result || !result->profile) {
+        Py_RETURN_NONE;
+    }
+    auto &profile = *result->profile;
+    auto blocks = PyList_New(profile.block_num);
+    auto calls = PyDict_New();
+    auto branches = PyDict_New();
+    auto types = PyDict_New();
+    auto ok = blocks && calls && branches && types;
+    unsigned start = 0;
+    for (auto i : IntRange(ok ? profile.block_num : 0)) {
+        auto item = Py_BuildValue("(IIK)", start, profile.block_ends[i], profile.counts[i]);
+        ok = ok && item;
+        if (item) {
+            PyList_SET_ITEM(blocks, i, item);
+        }
+        start = profile.block_ends[i];
+    }
+    for (auto i : IntRange(profile.block_num)) {
+        if (ok && profile.conditional_ends.get(i)) {
+            auto taken = min(profile.counts[profile.jumpIndex(i)], profile.counts[i]);
+            auto key = PyLong_FromUnsignedLong(profile.block_ends[i] - 1);
+            auto value = Py_BuildValue("(KK)", taken, profile.counts[i] - taken);
+            ok = key && value && !PyDict_SetItem(branches, key, value);
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+        }
+    }
+    for (auto i : IntRange(profile.type_site_num)) {
+        auto &seen = profile.observed_types[i];
+        if (ok && seen.left) {
+            auto key = PyLong_FromUnsignedLong(profile.type_sites[i]);
+            auto value = Py_BuildValue("(ssO)", seen.left->tp_name, seen.right->tp_name,
+                    seen.polymorphic ? Py_True : Py_False);
+            ok = key && value && !PyDict_SetItem(types, key, value);
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+        }
+    }
+    for (auto vpc : IntRange(profile.instr_num)) {
+        auto count = profile.counts[profile.block_num + vpc];
+        if (ok && count) {
+            auto key = PyLong_FromUnsignedLong(vpc);
+            auto value = PyLong_FromUnsignedLongLong(count);
+            ok = key && value && !PyDict_SetItem(calls, key, value);
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+        }
+    }
+    auto dict = ok ? Py_BuildValue("{sOsOsOsO}", "blocks", blocks, "branches", branches,
+            "operand_types", types, "helper_calls", calls) : nullptr;
+    Py_XDECREF(blocks);
+    Py_XDECREF(calls);
+    Py_XDECREF(branches);
+    Py_XDECREF(types);
+    return dict;
+}
+
+PyObject *enable_stats(PyObject *, PyObject *flag) {
+    auto enabled = PyObject_IsTrue(flag);
+    if (enabled < 0) {
+        return nullptr;
+    }
+    auto previous = jit_statistics.count_helper_calls;
+    jit_statistics.count_helper_calls = enabled;
+    jit_statistics.record(event_stats_toggled, enabled, "");
+    return PyBool_FromLong(previous);
+}
+
+PyObject *set_memory_budget(PyObject *, PyObject *bytes) {
+    auto budget = PyLong_AsSize_t(bytes);
+    if (budget == static_cast<size_t>(-1) && PyErr_Occurred()) {
+        return nullptr;
+    }
+    auto previous = memory_budget;
+    // 0 for no limit, a lower budget evicts what it can right away
+    memory_budget = budget;
+    makeRoom(0);
+    return PyLong_FromSize_t(previous);
+}
+
+PyObject *reset_stats(PyObject *, PyObject *) {
+    jit_statistics.reset();
+    fill_n(helper_calls, external_symbol_count, 0);
+    Py_RETURN_NONE;
+}
+
+PyObject *recent_events(PyObject *, PyObject *) {
+    auto list = PyList_New(0);
+    if (!list) {
+        return nullptr;
+    }
+    auto ok = true;
+    jit_statistics.forEachEvent([&](const JitEvent &e) {
+        if (!ok) {
+            return;
+        }
+        auto item = Py_BuildValue("(LsLss)", e.timestamp, jit_event_names[e.kind], e.value, e.subject, e.detail);
+        ok = item && !PyList_Append(list, item);
+        Py_XDECREF(item);
+    });
+    if (!ok) {
+        Py_DECREF(list);
+        return nullptr;
+    }
+    return list;
+}
+
 PyMODINIT_FUNC PyInit_compyler() {
     try {
         translator = make_unique<Translator>();
@@ -83,7 +437,19 @@ PyMODINIT_FUNC PyInit_compyler() {
         return nullptr;
     }
 
-    static PyMethodDef meth_def[] = {{"apply", apply, METH_O}, {}};
+    static PyMethodDef meth_def[] = {
+            {"apply", reinterpret_cast<PyCFunction>(static_cast<PyCFunctionWithKeywords>(apply)),
+                    METH_VARARGS | METH_KEYWORDS},
+            {"analyze", analyze, METH_O},
+            {"stats", stats, METH_NOARGS},
+            {"function_stats", function_stats, METH_O},
+            {"block_profile", block_profile, METH_O},
+            {"enable_stats", enable_stats, METH_O},
+            {"reset_stats", reset_stats, METH_NOARGS},
+            {"set_memory_budget", set_memory_budget, METH_O},
+            {"recent_events", recent_events, METH_NOARGS},
+            {}
+    };
     static PyModuleDef mod_def = {
             PyModuleDef_HEAD_INIT,
             "comPyler",
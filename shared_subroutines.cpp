@@ -15,6 +15,7 @@
 
 #include "shared_symbols.h"
 #include "general_utilities.h"
+#include "jit_statistics.h"
 
 using namespace std;
 
@@ -51,18 +52,25 @@ void handle_XDECREF(PyObject *obj) {
 // TODO: 在想，能不能设计俩版本，decref在这里实现
 // TODO: 能否设置hot inline等确保展开
 
-[[noreturn]] static void gotoUnwind(PyThreadState *tstate, PyFrameObject *f) {
+static auto getTryRegion(PyThreadState *tstate, PyFrameObject *frame) {
+    assert(tstate->frame == frame);
+    return static_cast<ExtendedCFrame *>(tstate->cframe)->region_map[frame->f_lasti];
+}
+
+[[noreturn]] static void gotoUnwind(PyThreadState *tstate, PyFrameObject *f, int region) {
     auto cframe = static_cast<ExtendedCFrame *>(tstate->cframe);
     f->f_state = FRAME_UNWINDING;
-    ptrdiff_t handler = -1;
+    int handler = -1;
 
-    while (f->f_iblock > 0) {
-        /* Pop the current block. */
-        PyTryBlock *b = &f->f_blockstack[--f->f_iblock];
+    for (; region >= 0; region = cframe->try_regions[region].parent) {
+        auto &r = cframe->try_regions[region];
 
-        if (b->b_type == EXCEPT_HANDLER) {
+        if (r.handler < 0) {
+            /* Pop the EXCEPT_HANDLER block pushed when entering the handler. */
+            [[maybe_unused]] auto b = PyFrame_BlockPop(f);
+            assert(b->b_type == EXCEPT_HANDLER && b->b_level == r.level);
             PyObject *type, *value, *traceback;
-            while (f->f_stackdepth > b->b_level + 3) {
+            while (f->f_stackdepth > r.level + 3) {
                 Py_XDECREF(f->f_valuestack[--f->f_stackdepth]);
             }
             auto exc_info = tstate->exc_info;
@@ -77,52 +85,48 @@ void handle_XDECREF(PyObject *obj) {
             Py_XDECREF(traceback);
             continue;
         }
-        while (f->f_stackdepth > b->b_level) {
+        while (f->f_stackdepth > r.level) {
             PyObject *v = f->f_valuestack[--f->f_stackdepth];
             Py_XDECREF(v);
         }
-        assert(b->b_type == SETUP_FINALLY);
-        if (b->b_type == SETUP_FINALLY) {
-            PyObject *exc, *val, *tb;
-            handler = b->b_handler;
-            _PyErr_StackItem *exc_info = tstate->exc_info;
-            /* Beware, this invalidates all b->b_* fields */
-            PyFrame_BlockSetup(f, EXCEPT_HANDLER, f->f_lasti, f->f_stackdepth);
-            f->f_valuestack[f->f_stackdepth++] = exc_info->exc_traceback;
-            f->f_valuestack[f->f_stackdepth++] = exc_info->exc_value;
-            if (exc_info->exc_type) {
-                f->f_valuestack[f->f_stackdepth++] = exc_info->exc_type;
-            } else {
-                Py_INCREF(Py_None);
-                f->f_valuestack[f->f_stackdepth++] = Py_None;
-            }
-            _PyErr_Fetch(tstate, &exc, &val, &tb);
-            /* Make the raw exception data
-               available to the handler,
-               so a program can emulate the
-               Python main loop. */
-            _PyErr_NormalizeException(tstate, &exc, &val, &tb);
-            if (tb) {
-                PyException_SetTraceback(val, tb);
-            } else {
-                PyException_SetTraceback(val, Py_None);
-            }
-            Py_INCREF(exc);
-            exc_info->exc_type = exc;
-            Py_INCREF(val);
-            exc_info->exc_value = val;
-            exc_info->exc_traceback = tb;
-            if (!tb) {
-                tb = Py_None;
-            }
-            Py_INCREF(tb);
-            f->f_valuestack[f->f_stackdepth++] = tb;
-            f->f_valuestack[f->f_stackdepth++] = val;
-            f->f_valuestack[f->f_stackdepth++] = exc;
-            /* Resume normal execution */
-            f->f_state = FRAME_EXECUTING;
-            break;
-        }
+        PyObject *exc, *val, *tb;
+        handler = r.handler;
+        _PyErr_StackItem *exc_info = tstate->exc_info;
+        PyFrame_BlockSetup(f, EXCEPT_HANDLER, f->f_lasti, f->f_stackdepth);
+        f->f_valuestack[f->f_stackdepth++] = exc_info->exc_traceback;
+        f->f_valuestack[f->f_stackdepth++] = exc_info->exc_value;
+        if (exc_info->exc_type) {
+            f->f_valuestack[f->f_stackdepth++] = exc_info->exc_type;
+        } else {
+            Py_INCREF(Py_None);
+            f->f_valuestack[f->f_stackdepth++] = Py_None;
+        }
+        _PyErr_Fetch(tstate, &exc, &val, &tb);
+        /* Make the raw exception data
+           available to the handler,
+           so a program can emulate the
+           Python main loop. */
+        _PyErr_NormalizeException(tstate, &exc, &val, &tb);
+        if (tb) {
+            PyException_SetTraceback(val, tb);
+        } else {
+            PyException_SetTraceback(val, Py_None);
+        }
+        Py_INCREF(exc);
+        exc_info->exc_type = exc;
+        Py_INCREF(val);
+        exc_info->exc_value = val;
+        exc_info->exc_traceback = tb;
+        if (!tb) {
+            tb = Py_None;
+        }
+        Py_INCREF(tb);
+        f->f_valuestack[f->f_stackdepth++] = tb;
+        f->f_valuestack[f->f_stackdepth++] = val;
+        f->f_valuestack[f->f_stackdepth++] = exc;
+        /* Resume normal execution */
+        f->f_state = FRAME_EXECUTING;
+        break;
     }
 
     if (handler >= 0) {
@@ -147,15 +151,76 @@ static auto getStackDepth(PyThreadState *tstate, PyFrameObject *frame) {
     assert(_PyErr_Occurred(tstate));
     auto f = tstate->frame;
     PyTraceBack_Here(f);
-    assert(!tstate->c_tracefunc); // TODO: 要不要支持它
+    // a frame that was already running when tracing started stays compiled and is not traced
     f->f_stackdepth = getStackDepth(tstate, f);
-    gotoUnwind(tstate, f);
+    gotoUnwind(tstate, f, getTryRegion(tstate, f));
 }
 
 [[noreturn]] static void gotoErrorHandler() {
     gotoErrorHandler(_PyThreadState_GET());
 }
 
+void restoreBlockStack(PyFrameObject *f, const TryRegion *try_regions, const VpcMap &region_map, int vpc) {
+    // the compiled code only keeps the EXCEPT_HANDLER blocks, put the try blocks back in between
+    int chain[CO_MAXBLOCKS];
+    int depth = 0;
+    for (auto region = region_map[vpc]; region >= 0; region = try_regions[region].parent) {
+        assert(depth < CO_MAXBLOCKS);
+        chain[depth++] = region;
+    }
+    PyTryBlock except_handlers[CO_MAXBLOCKS];
+    auto except_handler_num = f->f_iblock;
+    copy_n(f->f_blockstack, except_handler_num, except_handlers);
+    int next_except_handler = 0;
+    f->f_iblock = 0;
+    while (depth--) {
+        auto &r = try_regions[chain[depth]];
+        if (r.handler < 0) {
+            f->f_blockstack[f->f_iblock++] = except_handlers[next_except_handler++];
+        } else {
+            f->f_blockstack[f->f_iblock++] = {SETUP_FINALLY, r.handler_vpc, r.level};
+        }
+    }
+    assert(next_except_handler == except_handler_num);
+    f->f_blockstack[CO_MAXBLOCKS - 1].b_handler = resume_in_interpreter;
+}
+
+PyObject *resumeInInterpreter(PyFrameObject *f, int vpc, int stack_height) {
+    jit_statistics.counters[counter_interpreter_exits]++;
+    auto tstate = _PyThreadState_GET();
+    auto cframe = static_cast<ExtendedCFrame *>(tstate->cframe);
+    restoreBlockStack(f, cframe->try_regions, cframe->region_map, vpc);
+    f->f_lasti = vpc - 1;
+    f->f_stackdepth = stack_height;
+    auto interpreter_code = reinterpret_cast<PyCodeObject *>(cframe->interpreter_code);
+    if (!interpreter_code || cframe->use_tracing) {
+        return _PyEval_EvalFrameDefault(tstate, f, 0);
+    }
+    // the copy differs only by the YIELD_VALUE at the headers, the frame gets its own code back before anyone sees it
+    auto own_code = f->f_code;
+    f->f_code = interpreter_code;
+    auto result = _PyEval_EvalFrameDefault(tstate, f, 0);
+    f->f_code = own_code;
+    if (f->f_state != FRAME_SUSPENDED) {
+        return result;
+    }
+    // the code is no generator, so it stopped at a header, put back the iterator which YIELD_VALUE took from FOR_ITER
+    f->f_valuestack[f->f_stackdepth] = result;
+    auto iblock = 0;
+    for (auto &b : PtrRange(f->f_blockstack, f->f_iblock)) {
+        if (b.b_type == EXCEPT_HANDLER) {
+            f->f_blockstack[iblock++] = b;
+        }
+    }
+    f->f_iblock = iblock;
+    f->f_blockstack[CO_MAXBLOCKS - 1].b_handler = 0;
+    f->f_stackdepth = 0;
+    f->f_state = FRAME_EXECUTING;
+    tstate->frame = f;
+    // the compiled code continues at f_lasti
+    return nullptr;
+}
+
 template <typename... T>
 static inline void gotoErrorHandler(bool cond, T... args) {
     // TODO: 是不是都是unlikely
@@ -196,9 +261,10 @@ static void raiseUndefinedFree(PyThreadState *tstate, PyObject *name) {
     raiseUndefinedName(tstate, name, "free variable '%.200s' referenced before assignment in enclosing scope");
 }
 
-void raiseException() {
+void raiseException(int vpc) {
     auto tstate = _PyThreadState_GET();
     auto frame = tstate->frame;
+    frame->f_lasti = vpc;
     auto code = frame->f_code;
     auto py_instr = PyInstrPointer(code);
     auto current_instr = py_instr + frame->f_lasti;
@@ -229,6 +295,35 @@ void raiseException() {
     gotoErrorHandler(tstate);
 }
 
+// the same as COMPUTE_EVAL_BREAKER in ceval.c
+static void recomputeEvalBreaker(PyInterpreterState *interp) {
+    auto ceval2 = &interp->ceval;
+    _Py_atomic_store_relaxed(&ceval2->eval_breaker,
+            _Py_atomic_load_relaxed(&ceval2->gil_drop_request)
+            | (_Py_atomic_load_relaxed(&_PyRuntime.ceval.signals_pending) && _Py_ThreadCanHandleSignals(interp))
+            | (_Py_atomic_load_relaxed(&ceval2->pending.calls_to_do) && _Py_ThreadCanHandlePendingCalls())
+            | ceval2->pending.async_exc);
+}
+
+// polled at loop headers, does what eval_frame_handle_pending in ceval.c does
+void handleEvalBreaker() {
+    auto tstate = _PyThreadState_GET();
+    auto ceval2 = &tstate->interp->ceval;
+    gotoErrorHandler(Py_MakePendingCalls() < 0, tstate);
+    if (_Py_atomic_load_relaxed(&ceval2->gil_drop_request)) {
+        // give another thread a chance
+        PyEval_RestoreThread(PyEval_SaveThread());
+    }
+    if (auto exc = tstate->async_exc) {
+        tstate->async_exc = nullptr;
+        ceval2->pending.async_exc = 0;
+        recomputeEvalBreaker(tstate->interp);
+        _PyErr_SetNone(tstate, exc);
+        Py_DECREF(exc);
+        gotoErrorHandler(tstate);
+    }
+}
+
 PyObject *handle_LOAD_CLASSDEREF(PyFrameObject *f, Py_ssize_t oparg) {
     auto locals = f->f_locals;
     assert(locals);
@@ -431,11 +526,60 @@ PyObject *handle_BINARY_SUBSCR(PyObject *container, PyObject *sub) {
     return value;
 }
 
+PyObject *handle_BINARY_SUBSCR_DICT(PyObject *dict, PyObject *key, Py_hash_t hash) {
+    assert(PyDict_CheckExact(dict));
+    if (hash == -1) {
+        hash = PyObject_Hash(key);
+        gotoErrorHandler(hash == -1);
+    }
+    auto value = _PyDict_GetItem_KnownHash(dict, key, hash);
+    if (!value) [[unlikely]] {
+        auto tstate = _PyThreadState_GET();
+        if (!_PyErr_Occurred(tstate)) {
+            _PyErr_SetKeyError(key);
+        }
+        gotoErrorHandler(tstate);
+    }
+    Py_INCREF(value);
+    return value;
+}
+
+PyObject *handle_BINARY_SUBSCR_STR(PyObject *str, Py_ssize_t index) {
+    assert(PyUnicode_CheckExact(str));
+    gotoErrorHandler(PyUnicode_READY(str) < 0);
+    auto len = PyUnicode_GET_LENGTH(str);
+    if (index < 0) {
+        index += len;
+    }
+    if (index < 0 || index >= len) [[unlikely]] {
+        PyErr_SetString(PyExc_IndexError, "string index out of range");
+        gotoErrorHandler();
+    }
+    auto value = PyUnicode_FromOrdinal(PyUnicode_READ_CHAR(str, index));
+    gotoErrorHandler(!value);
+    return value;
+}
+
 void handle_STORE_SUBSCR(PyObject *container, PyObject *sub, PyObject *value) {
     auto err = PyObject_SetItem(container, sub, value);
     gotoErrorHandler(err);
 }
 
+void handle_STORE_SUBSCR_DICT(PyObject *dict, PyObject *key, PyObject *value, Py_hash_t hash) {
+    assert(PyDict_CheckExact(dict));
+    if (hash == -1) {
+        hash = PyObject_Hash(key);
+        gotoErrorHandler(hash == -1);
+    }
+    auto err = _PyDict_SetItem_KnownHash(dict, key, value, hash);
+    gotoErrorHandler(err);
+}
+
+void handle_DELETE_SUBSCR(PyObject *container, PyObject *sub) {
+    auto err = PyObject_DelItem(container, sub);
+    gotoErrorHandler(err);
+}
+
 static const char *getSlotSign(size_t offset) {
     switch (offset) {
     case offsetof(PyNumberMethods, nb_add):
@@ -651,7 +795,7 @@ PyObject *handle_BINARY_ADD(PyObject *v, PyObject *w) {
         return result;
     }
     auto m = Py_TYPE(v)->tp_as_sequence;
-    if (!m || !m->sq_concat) {
+    if (m && m->sq_concat) {
         result = (m->sq_concat)(v, w);
         checkSlotResult(v, op_slot, result);
         gotoErrorHandler(!result);
@@ -892,6 +1036,18 @@ PyObject *handle_COMPARE_OP(PyObject *v, PyObject *w, int op) {
     gotoErrorHandler(tstate);
 }
 
+bool handle_COMPARE_OP_BOOL(PyObject *v, PyObject *w, int op) {
+    auto res = handle_COMPARE_OP(v, w, op);
+    if (res == Py_True || res == Py_False) {
+        Py_DECREF(res);
+        return res == Py_True;
+    }
+    auto truth = PyObject_IsTrue(res);
+    Py_DECREF(res);
+    gotoErrorHandler(truth < 0);
+    return truth;
+}
+
 bool handle_CONTAINS_OP(PyObject *container, PyObject *value) {
     auto sqm = Py_TYPE(container)->tp_as_sequence;
     Py_ssize_t res;
@@ -904,6 +1060,29 @@ bool handle_CONTAINS_OP(PyObject *container, PyObject *value) {
     return res > 0;
 }
 
+bool handle_CONTAINS_OP_SET(PyObject *set, PyObject *key) {
+    // set_contains also retries an unhashable set key as a frozenset
+    auto res = PySet_Type.tp_as_sequence->sq_contains(set, key);
+    gotoErrorHandler(res < 0);
+    return res;
+}
+
+bool handle_CONTAINS_OP_DICT(PyObject *dict, PyObject *key, Py_hash_t hash) {
+    if (hash == -1) {
+        hash = PyObject_Hash(key);
+        gotoErrorHandler(hash == -1);
+    }
+    auto res = _PyDict_Contains_KnownHash(dict, key, hash);
+    gotoErrorHandler(res < 0);
+    return res;
+}
+
+bool handle_CONTAINS_OP_STR(PyObject *str, PyObject *sub) {
+    auto res = PyUnicode_Contains(str, sub);
+    gotoErrorHandler(res < 0);
+    return res;
+}
+
 bool castPyObjectToBool(PyObject *o) {
     if (o == Py_None) {
         return false;
@@ -923,6 +1102,27 @@ bool castPyObjectToBool(PyObject *o) {
     return res > 0;
 }
 
+PyObject *boxFloat(double value) {
+    auto res = PyFloat_FromDouble(value);
+    gotoErrorHandler(!res);
+    return res;
+}
+
+PyObject *boxInt(Py_ssize_t value) {
+    auto res = PyLong_FromSsize_t(value);
+    gotoErrorHandler(!res);
+    return res;
+}
+
+void recordTypes(ObservedTypes *seen, PyTypeObject *left, PyTypeObject *right) {
+    // called only when the pair differs from the kept one, which becomes the latest
+    seen->polymorphic = seen->left != nullptr;
+    Py_INCREF(left);
+    Py_INCREF(right);
+    Py_XSETREF(seen->left, left);
+    Py_XSETREF(seen->right, right);
+}
+
 PyObject *handle_GET_ITER(PyObject *o) {
     auto type = Py_TYPE(o);
     if (type->tp_iter) {
@@ -1016,15 +1216,132 @@ void handle_FOR_ITER() {
     }
 }
 
+static Py_ssize_t countDecimalDigits(unsigned long long v) {
+    Py_ssize_t n = 1;
+    while (v >= 10) {
+        v /= 10;
+        n++;
+    }
+    return n;
+}
+
+static PyObject *joinStringPieces(PyObject **arr, Py_ssize_t num) {
+    auto strs = PyTuple_New(num);
+    gotoErrorHandler(!strs);
+    for (auto i : IntRange(num)) {
+        auto str = PyUnicode_Check(arr[i]) ? Py_NewRef(arr[i]) : PyObject_Str(arr[i]);
+        if (!str) {
+            Py_DECREF(strs);
+            gotoErrorHandler();
+        }
+        PyTuple_SET_ITEM(strs, i, str);
+    }
+    auto empty = PyUnicode_New(0, 0);
+    auto res = empty ? _PyUnicode_JoinArray(empty, &PyTuple_GET_ITEM(strs, 0), num) : nullptr;
+    Py_XDECREF(empty);
+    Py_DECREF(strs);
+    gotoErrorHandler(!res);
+    return res;
+}
+
+// the pieces are borrowed, each of which is either a str,
+// or an exact int or float whose formatting is deferred here by FORMAT_VALUE
 PyObject *handle_BUILD_STRING(PyObject **arr, Py_ssize_t num) {
-    auto str = PyUnicode_New(0, 0);
-    gotoErrorHandler(!str);
-    str = _PyUnicode_JoinArray(str, arr, num);
-    gotoErrorHandler(!str);
-    while (--num >= 0) {
-        Py_DECREF(arr[num]);
+    constexpr Py_ssize_t max_pieces = 32;
+    if (num > max_pieces) {
+        return joinStringPieces(arr, num);
+    }
+
+    struct {
+        PyObject *str;
+        char *text;
+        unsigned long long magnitude;
+        Py_ssize_t length;
+    } pieces[max_pieces];
+    Py_ssize_t total_length = 0;
+    Py_UCS4 max_char = 0;
+    Py_ssize_t prepared = 0;
+    auto release = [&]() {
+        while (--prepared >= 0) {
+            auto &piece = pieces[prepared];
+            PyMem_Free(piece.text);
+            if (piece.str && piece.str != arr[prepared]) {
+                Py_DECREF(piece.str);
+            }
+        }
+    };
+
+    for (auto i : IntRange(num)) {
+        auto obj = arr[i];
+        auto &piece = pieces[prepared++];
+        piece.str = nullptr;
+        piece.text = nullptr;
+        if (PyLong_CheckExact(obj)) {
+            int overflow;
+            auto v = PyLong_AsLongLongAndOverflow(obj, &overflow);
+            if (!overflow) {
+                piece.magnitude = v < 0 ? 0ULL - static_cast<unsigned long long>(v) : v;
+                piece.length = (v < 0) + countDecimalDigits(piece.magnitude);
+            } else if (!(piece.str = PyObject_Str(obj))) {
+                release();
+                gotoErrorHandler();
+            }
+        } else if (PyFloat_CheckExact(obj)) {
+            piece.text = PyOS_double_to_string(PyFloat_AS_DOUBLE(obj), 'r', 0, Py_DTSF_ADD_DOT_0, nullptr);
+            if (!piece.text) {
+                release();
+                gotoErrorHandler();
+            }
+            piece.length = strlen(piece.text);
+        } else {
+            piece.str = obj;
+        }
+        if (piece.str) {
+            if (PyUnicode_READY(piece.str) < 0) {
+                release();
+                gotoErrorHandler();
+            }
+            piece.length = PyUnicode_GET_LENGTH(piece.str);
+            max_char = max(max_char, PyUnicode_MAX_CHAR_VALUE(piece.str));
+        }
+        if (piece.length > PY_SSIZE_T_MAX - total_length) {
+            release();
+            PyErr_SetString(PyExc_OverflowError, "join() result is too long for a Python string");
+            gotoErrorHandler();
+        }
+        total_length += piece.length;
+    }
+
+    auto res = PyUnicode_New(total_length, max_char);
+    if (!res) {
+        release();
+        gotoErrorHandler();
     }
-    return str;
+    auto kind = PyUnicode_KIND(res);
+    auto data = PyUnicode_DATA(res);
+    Py_ssize_t pos = 0;
+    for (auto &piece : PtrRange(pieces, num)) {
+        if (piece.str) {
+            _PyUnicode_FastCopyCharacters(res, pos, piece.str, 0, piece.length);
+        } else if (piece.text) {
+            for (auto i : IntRange(piece.length)) {
+                PyUnicode_WRITE(kind, data, pos + i, static_cast<Py_UCS1>(piece.text[i]));
+            }
+        } else {
+            auto v = piece.magnitude;
+            auto i = piece.length;
+            do {
+                PyUnicode_WRITE(kind, data, pos + --i, static_cast<Py_UCS1>('0' + v % 10));
+                v /= 10;
+            } while (v);
+            if (i) {
+                PyUnicode_WRITE(kind, data, pos, '-');
+            }
+        }
+        pos += piece.length;
+    }
+    release();
+    return res;
 }
 
 PyObject *handle_BUILD_TUPLE(PyObject **arr, Py_ssize_t num) {
@@ -1899,9 +2216,10 @@ bool handle_JUMP_IF_NOT_EXC_MATCH(PyObject *left, PyObject *right) {
 void handle_RERAISE(PyFrameObject *f, bool restore_lasti) {
     assert(f->f_iblock > 0);
     const auto &try_block = f->f_blockstack[f->f_iblock - 1];
-    f->f_lasti = restore_lasti ? try_block.b_handler : f->f_lasti;
     auto tstate = _PyThreadState_GET();
     auto stackdepth = getStackDepth(tstate, f);
+    auto region = getTryRegion(tstate, f);
+    f->f_lasti = restore_lasti ? try_block.b_handler : f->f_lasti;
     assert(stackdepth == try_block.b_level + 6);
     // TODO: 直接传arr[3]进来如何
     PyObject *exc = f->f_valuestack[--stackdepth];
@@ -1910,10 +2228,10 @@ void handle_RERAISE(PyFrameObject *f, bool restore_lasti) {
     f->f_stackdepth = stackdepth;
     assert(PyExceptionClass_Check(exc));
     _PyErr_Restore(tstate, exc, val, tb);
-    gotoUnwind(tstate, f);
+    gotoUnwind(tstate, f, region);
 }
 
-void handle_SETUP_WITH(PyFrameObject *f, PyObject **sp, int handler) {
+void handle_SETUP_WITH(PyObject **sp) {
     // TODO：考虑到load消除可能有问题
     _Py_IDENTIFIER(__enter__);
     _Py_IDENTIFIER(__exit__);
@@ -1942,8 +2260,7 @@ void handle_SETUP_WITH(PyFrameObject *f, PyObject **sp, int handler) {
     auto res = _PyObject_CallNoArg(enter);
     Py_DECREF(enter);
     gotoErrorHandler(!res);
-    *sp++ = res;
-    PyFrame_BlockSetup(f, SETUP_FINALLY, handler, sp - f->f_valuestack - 1); // TODO: 太黑暗了
+    *sp = res;
 }
 
 
@@ -2115,6 +2432,7 @@ PyObject *handle_GET_ANEXT(PyObject *aiter) {
 
 void handle_END_ASYNC_FOR(PyFrameObject *f) {
     auto tstate = _PyThreadState_GET();
+    f->f_stackdepth = getStackDepth(tstate, f);
     PyObject *exc = f->f_valuestack[--f->f_stackdepth];
     assert(PyExceptionClass_Check(exc));
     if (PyErr_GivenExceptionMatches(exc, PyExc_StopAsyncIteration)) {
@@ -2141,7 +2459,7 @@ void handle_END_ASYNC_FOR(PyFrameObject *f) {
         PyObject *val = f->f_valuestack[--f->f_stackdepth];
         PyObject *tb = f->f_valuestack[--f->f_stackdepth];
         _PyErr_Restore(tstate, exc, val, tb);
-        gotoUnwind(tstate, f);
+        gotoUnwind(tstate, f, getTryRegion(tstate, f));
     }
 }
 
@@ -2185,3 +2503,6 @@ const array<void *, external_symbol_count> symbol_addresses{apply(
         [](auto &&... x) noexcept { return array{reinterpret_cast<void *>(x.first) ...}; },
         external_symbols
 )};
+
+unsigned long long helper_calls[external_symbol_count]{};
+JitStatistics jit_statistics{};
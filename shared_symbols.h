@@ -1,6 +1,8 @@
 #ifndef PYNIC_SHARED_SYMBOLS
 #define PYNIC_SHARED_SYMBOLS
 
+#include <algorithm>
+#include <cassert>
 #include <csetjmp>
 
 #include <Python.h>
@@ -11,16 +13,63 @@
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/DataLayout.h>
 
+// try blocks are resolved at compile time, only EXCEPT_HANDLER blocks are pushed into f_blockstack when unwinding
+struct TryRegion {
+    int parent;      // index of the enclosing region, or -1
+    int level;       // stack depth of the try block
+    int handler;     // resume id of the handler, or -1 if the region is the body of an except handler
+    int handler_vpc; // first instruction of the handler, for the interpreter's block stack
+};
+
+// stored in place of a resume id once the frame has been handed over to the interpreter
+constexpr int resume_in_interpreter = -1;
+
+// a value which holds from vpc up to the vpc of the next range
+struct VpcRange {
+    int vpc;
+    int value;
+};
+
+// piecewise constant map from vpc, only the changes are stored
+struct VpcMap {
+    const VpcRange *ranges;
+    int range_num;
+
+    int operator[](int vpc) const {
+        auto next = std::upper_bound(ranges, ranges + range_num, vpc,
+                [](int vpc, const VpcRange &r) { return vpc < r.vpc; });
+        assert(next != ranges);
+        return next[-1].value;
+    }
+};
+
+// the operand types seen at an instruction by code compiled with profiling, the types are strong references
+struct ObservedTypes {
+    PyTypeObject *left;
+    PyTypeObject *right;
+    // another pair was seen before the one kept
+    bool polymorphic;
+};
+
 struct ExtendedCFrame : CFrame {
     jmp_buf frame_jmp_buf;
-    int *sp_map;
+    VpcMap sp_map;
+    const TryRegion *try_regions;
+    VpcMap region_map;
+    // the copy of the code with a YIELD_VALUE at each header that the compiled code takes back, or null
+    PyObject *interpreter_code;
 };
 
+// rebuild the interpreter's block stack at vpc and mark the frame as handed over
+void restoreBlockStack(PyFrameObject *f, const TryRegion *try_regions, const VpcMap &region_map, int vpc);
+
 void handle_dealloc(PyObject *obj) [[clang::preserve_most]];
 void handle_INCREF(PyObject *obj);
 void handle_DECREF(PyObject *obj);
 void handle_XDECREF(PyObject *obj);
-void raiseException();
+void raiseException(int vpc);
+PyObject *resumeInInterpreter(PyFrameObject *f, int vpc, int stack_height);
+void handleEvalBreaker();
 
 PyObject *handle_LOAD_CLASSDEREF(PyFrameObject *f, Py_ssize_t oparg);
 PyObject *handle_LOAD_GLOBAL(PyFrameObject *f, PyObject *name);
@@ -33,7 +82,11 @@ PyObject *handle_LOAD_ATTR(PyObject *owner, PyObject *name);
 void handle_LOAD_METHOD(PyObject *name, PyObject **sp);
 void handle_STORE_ATTR(PyObject *owner, PyObject *name, PyObject *value);
 PyObject *handle_BINARY_SUBSCR(PyObject *container, PyObject *sub);
+PyObject *handle_BINARY_SUBSCR_DICT(PyObject *dict, PyObject *key, Py_hash_t hash);
+PyObject *handle_BINARY_SUBSCR_STR(PyObject *str, Py_ssize_t index);
 void handle_STORE_SUBSCR(PyObject *container, PyObject *sub, PyObject *value);
+void handle_STORE_SUBSCR_DICT(PyObject *dict, PyObject *key, PyObject *value, Py_hash_t hash);
+void handle_DELETE_SUBSCR(PyObject *container, PyObject *sub);
 
 PyObject *handle_UNARY_NOT(PyObject *value);
 PyObject *handle_UNARY_POSITIVE(PyObject *value);
@@ -67,7 +120,11 @@ PyObject *handle_INPLACE_OR(PyObject *v, PyObject *w);
 PyObject *handle_BINARY_XOR(PyObject *v, PyObject *w);
 PyObject *handle_INPLACE_XOR(PyObject *v, PyObject *w);
 PyObject *handle_COMPARE_OP(PyObject *v, PyObject *w, int op);
+bool handle_COMPARE_OP_BOOL(PyObject *v, PyObject *w, int op);
 bool handle_CONTAINS_OP(PyObject *container, PyObject *value);
+bool handle_CONTAINS_OP_SET(PyObject *set, PyObject *key);
+bool handle_CONTAINS_OP_DICT(PyObject *dict, PyObject *key, Py_hash_t hash);
+bool handle_CONTAINS_OP_STR(PyObject *str, PyObject *sub);
 
 PyObject *handle_CALL_FUNCTION(PyObject **func_args, Py_ssize_t nargs);
 PyObject *handle_CALL_METHOD(PyObject **func_args, Py_ssize_t nargs);
@@ -114,7 +171,7 @@ PyObject *handle_COPY_DICT_WITHOUT_KEYS(PyObject *subject, PyObject *keys);
 void handle_POP_EXCEPT(PyFrameObject *f);
 bool handle_JUMP_IF_NOT_EXC_MATCH(PyObject *left, PyObject *right);
 void handle_RERAISE(PyFrameObject *f, bool restore_lasti);
-void handle_SETUP_WITH(PyFrameObject *f, PyObject **sp, int handler);
+void handle_SETUP_WITH(PyObject **sp);
 PyObject *handle_WITH_EXCEPT_START(PyObject *exc, PyObject *val, PyObject *tb, PyObject *exit_func);
 
 PyObject *handle_YIELD_VALUE(PyObject *val);
@@ -126,6 +183,12 @@ void handle_END_ASYNC_FOR(PyFrameObject *f);
 void handle_BEFORE_ASYNC_WITH(PyObject **sp);
 
 bool castPyObjectToBool(PyObject *o);
+PyObject *boxFloat(double value);
+PyObject *boxInt(Py_ssize_t value);
+void recordTypes(ObservedTypes *seen, PyTypeObject *left, PyTypeObject *right);
+
+// indexed by the position in external_symbols, only bumped by code compiled while counting is enabled
+extern unsigned long long helper_calls[];
 
 #define ENTRY(X) std::pair{&(X), #X}
 
@@ -136,6 +199,8 @@ constexpr std::tuple external_symbols{
         ENTRY(handle_DECREF),
         ENTRY(handle_XDECREF),
         ENTRY(raiseException),
+        ENTRY(resumeInInterpreter),
+        ENTRY(handleEvalBreaker),
         ENTRY(handle_LOAD_CLASSDEREF),
         ENTRY(handle_LOAD_GLOBAL),
         ENTRY(handle_STORE_GLOBAL),
@@ -147,7 +212,11 @@ constexpr std::tuple external_symbols{
         ENTRY(handle_LOAD_METHOD),
         ENTRY(handle_STORE_ATTR),
         ENTRY(handle_BINARY_SUBSCR),
+        ENTRY(handle_BINARY_SUBSCR_DICT),
+        ENTRY(handle_BINARY_SUBSCR_STR),
         ENTRY(handle_STORE_SUBSCR),
+        ENTRY(handle_STORE_SUBSCR_DICT),
+        ENTRY(handle_DELETE_SUBSCR),
         ENTRY(handle_UNARY_NOT),
         ENTRY(handle_UNARY_POSITIVE),
         ENTRY(handle_UNARY_NEGATIVE),
@@ -180,7 +249,12 @@ constexpr std::tuple external_symbols{
         ENTRY(handle_BINARY_XOR),
         ENTRY(handle_INPLACE_XOR),
         ENTRY(handle_COMPARE_OP),
+        ENTRY(handle_COMPARE_OP_BOOL),
         ENTRY(handle_CONTAINS_OP),
+        ENTRY(handle_CONTAINS_OP_SET),
+        ENTRY(handle_CONTAINS_OP_DICT),
+        ENTRY(handle_CONTAINS_OP_STR),
+        ENTRY(_PyUnicode_EQ),
 
         ENTRY(handle_CALL_FUNCTION),
         ENTRY(handle_CALL_METHOD),
@@ -225,8 +299,6 @@ constexpr std::tuple external_symbols{
         ENTRY(hanlde_MATCH_CLASS),
         ENTRY(handle_COPY_DICT_WITHOUT_KEYS),
 
-        ENTRY(PyFrame_BlockSetup),
-        ENTRY(PyFrame_BlockPop),
         ENTRY(handle_POP_EXCEPT),
         ENTRY(handle_JUMP_IF_NOT_EXC_MATCH),
         ENTRY(handle_RERAISE),
@@ -243,10 +315,26 @@ constexpr std::tuple external_symbols{
         ENTRY(handle_BEFORE_ASYNC_WITH),
 
         ENTRY(castPyObjectToBool),
+        ENTRY(boxFloat),
+        ENTRY(boxInt),
+        ENTRY(recordTypes),
+        ENTRY(PyMem_Malloc),
+        ENTRY(helper_calls),
 
         ENTRY(_Py_FalseStruct),
         ENTRY(_Py_TrueStruct),
         ENTRY(_Py_NoneStruct),
+        ENTRY(PyLong_Type),
+        ENTRY(PyUnicode_Type),
+        ENTRY(PyTuple_Type),
+        ENTRY(PyList_Type),
+        ENTRY(PyDict_Type),
+        ENTRY(PyFloat_Type),
+        ENTRY(PySet_Type),
+        ENTRY(PyFrozenSet_Type),
+        ENTRY(PyBytes_Type),
+        ENTRY(PyByteArray_Type),
+        ENTRY(PyMemoryView_Type),
         ENTRY(PyExc_AssertionError),
 };
 
@@ -298,6 +386,11 @@ struct Normalizer<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T
     using type = std::make_signed_t<T>;
 };
 
+template <typename T>
+struct Normalizer<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    using type = T;
+};
+
 template <typename T>
 struct Normalizer<T, std::enable_if_t<!std::is_scalar_v<T> && !std::is_function_v<T>>> {
     using type = void;
@@ -330,6 +423,9 @@ static auto createType(llvm::LLVMContext &context) {
             return llvm::Type::getIntNTy(context, CHAR_BIT * sizeof(T));
         }
     }
+    if constexpr(std::is_same_v<T, double>) {
+        return llvm::Type::getDoubleTy(context);
+    }
     if constexpr(std::is_pointer_v<T>) {
         return llvm::PointerType::getUnqual(context);
     }
@@ -399,7 +495,7 @@ struct TypeDeduplicatorHelper<std::tuple<A...>, const std::tuple<B...>, C...> :
         NormalizedLLVMType<CompiledFunction>> {
 };
 using RegisteredTypes = TypeDeduplicatorHelper<
-        std::tuple<void *, bool, char, short, int, long, long long>,
+        std::tuple<void *, bool, char, short, int, long, long long, double>,
         decltype(external_symbols),
         decltype(PyTypeObject::tp_iternext)>;
 #endif
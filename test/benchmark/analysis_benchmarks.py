@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Time the bytecode analysis passes on large machine-generated functions.
+
+Only the front end runs (compyler.analyze), no IR is generated, so the numbers
+are independent of LLVM. Each shape is measured at growing sizes; the scaling
+exponent compares the largest and the smallest size, 1.0 means linear.
+"""
+import argparse
+import math
+import statistics
+import sys
+
+PHASES = ('parse_cfg', 'intra_block', 'try_regions', 'inter_block')
+
+
+def straight_line(n):
+    lines = ['def f(a):'] + [f'    x{i} = a' for i in range(16)]
+    lines += [f'    x{i % 16} = x{(i + 5) % 16} + {i}' for i in range(n)]
+    lines.append('    return x0')
+    return lines
+
+
+def many_locals(n):
+    lines = ['def f(a):'] + [f'    v{i} = a + {i}' for i in range(n)]
+    lines += [f'    a = v{i} - a' for i in range(0, n, 2)]
+    lines.append('    return a')
+    return lines
+
+
+def many_branches(n):
+    lines = ['def f(a):', '    r = 0']
+    for i in range(n):
+        lines += [f'    if a == {i}:', f'        r += {i}', '    else:', '        r -= 1']
+    lines.append('    return r')
+    return lines
+
+
+def many_try(n):
+    lines = ['def f(a):', '    r = 0']
+    for i in range(n):
+        lines += ['    try:', f'        r += a[{i}]',
+                  '    except IndexError:', '        r -= 1',
+                  '    finally:', '        r += 1']
+    lines.append('    return r')
+    return lines
+
+
+def deep_nesting(n):
+    # CPython rejects more than 20 statically nested blocks, so repeat nests of that depth
+    depth = 9
+    lines = ['def f(a):', '    r = 0']
+    for i in range(n):
+        indent = '    '
+        for d in range(depth):
+            if d % 2:
+                lines += [f'{indent}try:']
+            else:
+                lines += [f'{indent}for i{d} in a:']
+            indent += '    '
+        lines.append(f'{indent}r += {i}')
+        for d in reversed(range(depth)):
+            indent = indent[:-4]
+            if d % 2:
+                lines += [f'{indent}except ValueError:', f'{indent}    r -= {d}']
+    lines.append('    return r')
+    return lines
+
+
+SHAPES = {
+    'straight_line': (straight_line, 2000),
+    'many_locals': (many_locals, 250),
+    'many_branches': (many_branches, 500),
+    'many_try': (many_try, 250),
+    'deep_nesting': (deep_nesting, 40),
+}
+
+
+def build(shape, n):
+    namespace = {}
+    exec(compile('\n'.join(shape(n)), f'<{shape.__name__}:{n}>', 'exec'), namespace)
+    return namespace['f']
+
+
+def measure(compyler, func, repeat):
+    runs = [compyler.analyze(func) for _ in range(repeat)]
+    best = {phase: min(r[phase] for r in runs) for phase in PHASES}
+    best['total'] = sum(best[phase] for phase in PHASES)
+    best['stdev'] = statistics.stdev(sum(r[p] for p in PHASES) for r in runs) if repeat > 1 else 0
+    for key in ('allocated_bytes', 'instr_num', 'block_num', 'try_block_num'):
+        best[key] = runs[0][key]
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--module-dir', help='directory containing the built compyler.so')
+    parser.add_argument('--repeat', type=int, default=20, help='analysis runs per size, the fastest is kept')
+    parser.add_argument('--scales', type=int, nargs='+', default=[1, 2, 4, 8], help='size multipliers')
+    parser.add_argument('shapes', nargs='*', help='shapes to run (default: all)')
+    args = parser.parse_args()
+    if args.module_dir:
+        sys.path.insert(0, args.module_dir)
+    import compyler
+
+    print(f'{"shape":<16}{"instrs":>8}{"blocks":>8}{"tries":>6}'
+          + ''.join(f'{p:>13}' for p in PHASES)
+          + f'{"total":>12}{"ns/instr":>10}{"B/instr":>9}')
+    for name in args.shapes or SHAPES:
+        shape, base = SHAPES[name]
+        results = []
+        for scale in args.scales:
+            r = measure(compyler, build(shape, base * scale), args.repeat)
+            results.append(r)
+            print(f'{name:<16}{r["instr_num"]:>8}{r["block_num"]:>8}{r["try_block_num"]:>6}'
+                  + ''.join(f'{r[p] / 1e3:>11.1f}us' for p in PHASES)
+                  + f'{r["total"] / 1e3:>10.1f}us'
+                  + f'{r["total"] / r["instr_num"]:>10.1f}'
+                  + f'{r["allocated_bytes"] / r["instr_num"]:>9.1f}')
+        first, last = results[0], results[-1]
+        if len(results) > 1 and last['instr_num'] > first['instr_num']:
+            size_ratio = math.log(last['instr_num'] / first['instr_num'])
+            time_exp = math.log(last['total'] / first['total']) / size_ratio
+            mem_exp = math.log(last['allocated_bytes'] / first['allocated_bytes']) / size_ratio
+            print(f'{"":<16}scaling exponent: time {time_exp:.2f}, memory {mem_exp:.2f}')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
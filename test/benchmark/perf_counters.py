@@ -0,0 +1,144 @@
+"""Read hardware performance counters of the current thread through perf_event_open(2).
+
+Only user-space events are counted, so the default perf_event_paranoid setting is enough.
+Events the machine does not support (common in virtual machines) are reported as None.
+"""
+import ctypes
+import fcntl
+import os
+import platform
+import struct
+
+_PERF_TYPE_HARDWARE = 0
+_PERF_TYPE_HW_CACHE = 3
+
+_PERF_COUNT_HW_CPU_CYCLES = 0
+_PERF_COUNT_HW_INSTRUCTIONS = 1
+_PERF_COUNT_HW_BRANCH_MISSES = 5
+
+_PERF_COUNT_HW_CACHE_L1I = 1
+_PERF_COUNT_HW_CACHE_ITLB = 4
+_PERF_COUNT_HW_CACHE_OP_READ = 0
+_PERF_COUNT_HW_CACHE_RESULT_MISS = 1
+
+_PERF_FORMAT_TOTAL_TIME_ENABLED = 1 << 0
+_PERF_FORMAT_TOTAL_TIME_RUNNING = 1 << 1
+
+_FLAG_DISABLED = 1 << 0
+_FLAG_EXCLUDE_KERNEL = 1 << 5
+_FLAG_EXCLUDE_HV = 1 << 6
+
+_PERF_EVENT_IOC_ENABLE = 0x2400
+_PERF_EVENT_IOC_DISABLE = 0x2401
+_PERF_EVENT_IOC_RESET = 0x2403
+
+_SYSCALL_NUMBERS = {'x86_64': 298, 'aarch64': 241}
+
+
+def _cache_event(cache, op, result):
+    return cache | op << 8 | result << 16
+
+
+EVENTS = {
+    'cycles': (_PERF_TYPE_HARDWARE, _PERF_COUNT_HW_CPU_CYCLES),
+    'instructions': (_PERF_TYPE_HARDWARE, _PERF_COUNT_HW_INSTRUCTIONS),
+    'branch-misses': (_PERF_TYPE_HARDWARE, _PERF_COUNT_HW_BRANCH_MISSES),
+    'L1i-misses': (_PERF_TYPE_HW_CACHE, _cache_event(
+        _PERF_COUNT_HW_CACHE_L1I, _PERF_COUNT_HW_CACHE_OP_READ, _PERF_COUNT_HW_CACHE_RESULT_MISS)),
+    'iTLB-misses': (_PERF_TYPE_HW_CACHE, _cache_event(
+        _PERF_COUNT_HW_CACHE_ITLB, _PERF_COUNT_HW_CACHE_OP_READ, _PERF_COUNT_HW_CACHE_RESULT_MISS)),
+}
+
+
+class _PerfEventAttr(ctypes.Structure):
+    # PERF_ATTR_SIZE_VER5, the bit fields after sample_type are folded into flags
+    _fields_ = [
+        ('type', ctypes.c_uint32),
+        ('size', ctypes.c_uint32),
+        ('config', ctypes.c_uint64),
+        ('sample_period', ctypes.c_uint64),
+        ('sample_type', ctypes.c_uint64),
+        ('read_format', ctypes.c_uint64),
+        ('flags', ctypes.c_uint64),
+        ('wakeup_events', ctypes.c_uint32),
+        ('bp_type', ctypes.c_uint32),
+        ('config1', ctypes.c_uint64),
+        ('config2', ctypes.c_uint64),
+        ('branch_sample_type', ctypes.c_uint64),
+        ('sample_regs_user', ctypes.c_uint64),
+        ('sample_stack_user', ctypes.c_uint32),
+        ('clockid', ctypes.c_int32),
+        ('sample_regs_intr', ctypes.c_uint64),
+        ('aux_watermark', ctypes.c_uint32),
+        ('sample_max_stack', ctypes.c_uint16),
+        ('reserved', ctypes.c_uint16),
+    ]
+
+
+def _open_event(libc, syscall_number, event_type, config):
+    attr = _PerfEventAttr()
+    attr.type = event_type
+    attr.size = ctypes.sizeof(attr)
+    attr.config = config
+    attr.read_format = _PERF_FORMAT_TOTAL_TIME_ENABLED | _PERF_FORMAT_TOTAL_TIME_RUNNING
+    attr.flags = _FLAG_DISABLED | _FLAG_EXCLUDE_KERNEL | _FLAG_EXCLUDE_HV
+    # pid 0 and cpu -1: this thread on whatever cpu it runs
+    fd = libc.syscall(syscall_number, ctypes.byref(attr), 0, -1, -1, 0)
+    if fd < 0:
+        return None, os.strerror(ctypes.get_errno())
+    return fd, None
+
+
+class PerfCounters:
+    """Counts EVENTS between start() and stop(), possibly over several intervals."""
+
+    def __init__(self, events=EVENTS):
+        self.fds = {}
+        self.errors = {}
+        syscall_number = _SYSCALL_NUMBERS.get(platform.machine())
+        if syscall_number is None:
+            self.errors = dict.fromkeys(events, f'unsupported architecture {platform.machine()}')
+            return
+        libc = ctypes.CDLL(None, use_errno=True)
+        libc.syscall.restype = ctypes.c_long
+        for name, (event_type, config) in events.items():
+            fd, error = _open_event(libc, syscall_number, event_type, config)
+            if fd is None:
+                self.errors[name] = error
+            else:
+                self.fds[name] = fd
+
+    @property
+    def available(self):
+        return bool(self.fds)
+
+    def reset(self):
+        for fd in self.fds.values():
+            fcntl.ioctl(fd, _PERF_EVENT_IOC_RESET, 0)
+
+    def start(self):
+        for fd in self.fds.values():
+            fcntl.ioctl(fd, _PERF_EVENT_IOC_ENABLE, 0)
+
+    def stop(self):
+        for fd in self.fds.values():
+            fcntl.ioctl(fd, _PERF_EVENT_IOC_DISABLE, 0)
+
+    def read(self):
+        """Counts scaled up for the time the kernel multiplexed the event out, None if unsupported."""
+        values = dict.fromkeys(self.errors)
+        for name, fd in self.fds.items():
+            value, enabled, running = struct.unpack('QQQ', os.read(fd, 24))
+            values[name] = round(value * enabled / running) if running else None
+        return values
+
+    def close(self):
+        for fd in self.fds.values():
+            os.close(fd)
+        self.fds = {}
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
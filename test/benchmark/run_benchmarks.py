@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""Run every workload interpreted and then compiled, and report the speedup.
+
+Each workload runs in its own process so that a crash in the compiled code only
+fails that workload instead of the whole suite.
+"""
+import argparse
+import importlib
+import json
+import os
+import pkgutil
+import statistics
+import subprocess
+import sys
+import time
+
+BENCHMARK_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def list_workloads():
+    import workloads
+    return sorted(m.name for m in pkgutil.iter_modules(workloads.__path__))
+
+
+def measure(func, repeat, counters=None):
+    """Time every run, and count hardware events per run on average if counters are given."""
+    samples = []
+    result = None
+    if counters:
+        counters.reset()
+    for _ in range(repeat):
+        if counters:
+            counters.start()
+        start = time.perf_counter()
+        result = func()
+        samples.append(time.perf_counter() - start)
+        if counters:
+            counters.stop()
+    events = None
+    if counters:
+        events = {k: v and v / repeat for k, v in counters.read().items()}
+    return result, samples, events
+
+
+def run_worker(name, repeat, warmup, perf):
+    import compyler
+    module = importlib.import_module('workloads.' + name)
+    counters = None
+    if perf:
+        from perf_counters import PerfCounters
+        counters = PerfCounters()
+        if not counters.available:
+            raise RuntimeError('hardware counters unavailable: ' + '; '.join(
+                f'{k}: {v}' for k, v in counters.errors.items()))
+
+    for _ in range(warmup):
+        module.run()
+    expected, interpreted, interpreted_events = measure(module.run, repeat, counters)
+
+    compile_times = {}
+    for func in module.COMPILE:
+        start = time.perf_counter()
+        compyler.apply(func)
+        compile_times[func.__qualname__] = time.perf_counter() - start
+
+    for _ in range(warmup):
+        module.run()
+    actual, compiled, compiled_events = measure(module.run, repeat, counters)
+    if actual != expected:
+        raise AssertionError(f'compiled result differs: {actual!r} != {expected!r}')
+
+    data = {'interpreted': interpreted, 'compiled': compiled, 'compile_times': compile_times}
+    if counters:
+        data['events'] = {'interpreted': interpreted_events, 'compiled': compiled_events}
+        counters.close()
+    json.dump(data, sys.stdout)
+
+
+def spawn_worker(name, args):
+    cmd = [sys.executable, os.path.abspath(__file__), '--worker', name,
+           '--repeat', str(args.repeat), '--warmup', str(args.warmup)] + ['--perf'] * args.perf
+    env = dict(os.environ)
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, (args.module_dir, BENCHMARK_DIR, env.get('PYTHONPATH'))))
+    proc = subprocess.run(cmd, env=env, capture_output=True, text=True, timeout=args.timeout)
+    if proc.returncode:
+        reason = proc.stderr.strip().splitlines()[-1:] or [f'exit status {proc.returncode}']
+        return None, reason[0]
+    return json.loads(proc.stdout), None
+
+
+def summarize(samples):
+    mean = statistics.mean(samples)
+    stdev = statistics.stdev(samples) if len(samples) > 1 else 0.0
+    return mean, stdev
+
+
+def print_events(events):
+    """One line per mode with the counts per run, then the compiled/interpreted ratios."""
+    from perf_counters import EVENTS
+
+    def show(value, width=14):
+        return f'{"n/a":>{width}}' if value is None else f'{value:>{width}.4g}'
+
+    def ipc(counts):
+        if counts['cycles'] and counts['instructions'] is not None:
+            return counts['instructions'] / counts['cycles']
+        return None
+
+    interpreted, compiled = events['interpreted'], events['compiled']
+    for mode, counts in (('interpreted', interpreted), ('compiled', compiled)):
+        print(f'    {mode:<12}' + ''.join(show(counts[k]) for k in EVENTS) + show(ipc(counts), 8))
+    ratios = {k: compiled[k] / interpreted[k] if interpreted[k] and compiled[k] is not None else None
+              for k in EVENTS}
+    print(f'    {"ratio":<12}' + ''.join(show(ratios[k]) for k in EVENTS))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--module-dir', help='directory containing the built compyler.so')
+    parser.add_argument('--repeat', type=int, default=10, help='measured runs per mode')
+    parser.add_argument('--warmup', type=int, default=2, help='unmeasured runs before each mode')
+    parser.add_argument('--timeout', type=float, default=600, help='seconds allowed per workload')
+    parser.add_argument('--json', metavar='FILE', help='also write raw samples to FILE')
+    parser.add_argument('--verbose', action='store_true', help='print compile time of every function')
+    parser.add_argument('--perf', action='store_true',
+                        help='count cycles, instructions, branch and L1i/iTLB misses with perf_event_open')
+    parser.add_argument('--worker', help=argparse.SUPPRESS)
+    parser.add_argument('workloads', nargs='*', help='workloads to run (default: all)')
+    args = parser.parse_args()
+
+    if args.worker:
+        run_worker(args.worker, args.repeat, args.warmup, args.perf)
+        return 0
+
+    sys.path.insert(0, BENCHMARK_DIR)
+    names = args.workloads or list_workloads()
+    results = {}
+    failed = 0
+    print(f'{"workload":<14}{"interpreted":>20}{"compiled":>20}{"speedup":>10}{"compile":>12}')
+    if args.perf:
+        from perf_counters import EVENTS
+        print(f'    {"per run":<12}' + ''.join(f'{k:>14}' for k in EVENTS) + f'{"IPC":>8}')
+    for name in names:
+        data, error = spawn_worker(name, args)
+        if data is None:
+            failed += 1
+            print(f'{name:<14}FAILED: {error}')
+            continue
+        results[name] = data
+        i_mean, i_stdev = summarize(data['interpreted'])
+        c_mean, c_stdev = summarize(data['compiled'])
+        compile_total = sum(data['compile_times'].values())
+        print(f'{name:<14}'
+              f'{i_mean * 1e3:>11.2f}ms ±{i_stdev / i_mean:>5.1%}'
+              f'{c_mean * 1e3:>11.2f}ms ±{c_stdev / c_mean:>5.1%}'
+              f'{i_mean / c_mean:>9.2f}x'
+              f'{compile_total * 1e3:>10.2f}ms')
+        if args.verbose:
+            for func, seconds in data['compile_times'].items():
+                print(f'    {func:<40}{seconds * 1e3:>10.2f}ms')
+        if args.perf:
+            print_events(data['events'])
+
+    if args.json:
+        with open(args.json, 'wt') as f:
+            json.dump(results, f, indent=2)
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,3 @@
+# Each workload module exposes:
+#   run()    -- the measured entry, its return value must not depend on whether it is compiled
+#   COMPILE  -- the functions handed to compyler.apply() for the compiled run
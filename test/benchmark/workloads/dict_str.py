@@ -0,0 +1,41 @@
+WORDS = ('alpha', 'beta', 'gamma', 'delta', 'epsilon', 'zeta', 'eta', 'theta')
+
+
+def make_text(n):
+    return ' '.join(WORDS[(i * 7) % len(WORDS)] for i in range(n))
+
+
+def word_count(text):
+    counts = {}
+    for word in text.split():
+        if word in counts:
+            counts[word] += 1
+        else:
+            counts[word] = 1
+    return counts
+
+
+def render(counts):
+    lines = []
+    for key, value in sorted(counts.items()):
+        if key in ('alpha', 'beta', 'gamma'):
+            lines.append(f'{key}: {value}*')
+        else:
+            lines.append(f'{key}: {value}')
+    return '\n'.join(lines)
+
+
+def group_by_length(text):
+    groups = {}
+    for word in text.split():
+        groups.setdefault(len(word), []).append(word.upper())
+    return {k: len(v) for k, v in groups.items()}
+
+
+def run():
+    text = make_text(20000)
+    counts = word_count(text)
+    return render(counts), group_by_length(text)
+
+
+COMPILE = [word_count, render, group_by_length, run]
@@ -0,0 +1,40 @@
+class ParseError(Exception):
+    pass
+
+
+def parse_int(text):
+    if not text.isdigit():
+        raise ParseError(text)
+    return int(text)
+
+
+def parse_all(items):
+    good = 0
+    bad = 0
+    for item in items:
+        try:
+            good += parse_int(item)
+        except ParseError:
+            bad += 1
+        finally:
+            good += 1
+    return good, bad
+
+
+def lookup_all(table, keys):
+    found = 0
+    for key in keys:
+        try:
+            found += table[key]
+        except KeyError:
+            pass
+    return found
+
+
+def run():
+    items = [str(i) if i % 4 else 'x%d' % i for i in range(20000)]
+    table = {i: i for i in range(0, 20000, 3)}
+    return parse_all(items), lookup_all(table, range(20000))
+
+
+COMPILE = [parse_int, parse_all, lookup_all, run]
@@ -0,0 +1,33 @@
+def count_up(n):
+    i = 0
+    while i < n:
+        yield i
+        i += 1
+
+
+def evens(source):
+    for value in source:
+        if value % 2 == 0:
+            yield value
+
+
+def pairs(source):
+    prev = None
+    for value in source:
+        if prev is not None:
+            yield prev, value
+        prev = value
+
+
+def consume(n):
+    total = 0
+    for a, b in pairs(evens(count_up(n))):
+        total += b - a
+    return total
+
+
+def run():
+    return consume(200000), sum(x * x for x in count_up(50000))
+
+
+COMPILE = [count_up, evens, pairs, consume, run]
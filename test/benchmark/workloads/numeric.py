@@ -0,0 +1,42 @@
+def integer_loop(n):
+    total = 0
+    for i in range(n):
+        if i % 3:
+            total += i * 2
+        else:
+            total -= i
+    return total
+
+
+def float_loop(n):
+    x = 0.0
+    step = 1.0 / n
+    acc = 0.0
+    for _ in range(n):
+        acc += x * x + 0.5 * x
+        x += step
+    return round(acc, 6)
+
+
+def matrix_mul(a, b, size):
+    out = [[0] * size for _ in range(size)]
+    for i in range(size):
+        row = a[i]
+        out_row = out[i]
+        for j in range(size):
+            s = 0
+            for k in range(size):
+                s += row[k] * b[k][j]
+            out_row[j] = s
+    return out
+
+
+def run():
+    size = 24
+    a = [[(i * size + j) % 7 for j in range(size)] for i in range(size)]
+    b = [[(i + j) % 5 for j in range(size)] for i in range(size)]
+    m = matrix_mul(a, b, size)
+    return integer_loop(100000), float_loop(50000), m[size - 1][size - 1]
+
+
+COMPILE = [integer_loop, float_loop, matrix_mul, run]
@@ -0,0 +1,48 @@
+class Vector:
+    __slots__ = ('x', 'y')
+
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+
+    def add(self, other):
+        return Vector(self.x + other.x, self.y + other.y)
+
+    def dot(self, other):
+        return self.x * other.x + self.y * other.y
+
+
+class Particle:
+    def __init__(self, pos, vel):
+        self.pos = pos
+        self.vel = vel
+        self.hits = 0
+
+    def step(self, bound):
+        self.pos = self.pos.add(self.vel)
+        if self.pos.x < 0 or self.pos.x > bound:
+            self.vel.x = -self.vel.x
+            self.hits += 1
+        if self.pos.y < 0 or self.pos.y > bound:
+            self.vel.y = -self.vel.y
+            self.hits += 1
+
+
+def simulate(particles, steps, bound):
+    for _ in range(steps):
+        for p in particles:
+            p.step(bound)
+    energy = 0
+    hits = 0
+    for p in particles:
+        energy += p.vel.dot(p.vel)
+        hits += p.hits
+    return energy, hits
+
+
+def run():
+    particles = [Particle(Vector(i % 17, i % 23), Vector(i % 3 + 1, i % 5 - 2)) for i in range(100)]
+    return simulate(particles, 200, 50)
+
+
+COMPILE = [Vector.__init__, Vector.add, Vector.dot, Particle.step, simulate, run]
@@ -0,0 +1,31 @@
+def fib(n):
+    if n < 2:
+        return n
+    return fib(n - 1) + fib(n - 2)
+
+
+def ackermann(m, n):
+    if m == 0:
+        return n + 1
+    if n == 0:
+        return ackermann(m - 1, 1)
+    return ackermann(m - 1, ackermann(m, n - 1))
+
+
+def tree_depth(node):
+    if node is None:
+        return 0
+    return 1 + max(tree_depth(node[0]), tree_depth(node[1]))
+
+
+def build_tree(depth):
+    if depth == 0:
+        return None
+    return build_tree(depth - 1), build_tree(depth - 1)
+
+
+def run():
+    return fib(22), ackermann(2, 200), tree_depth(build_tree(14))
+
+
+COMPILE = [fib, ackermann, tree_depth, build_tree, run]
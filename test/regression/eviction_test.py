@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Check that compyler.set_memory_budget evicts the least recently executed code.
+
+The budget covers the code and metadata bytes of every loaded function.
+Evicted functions run in the interpreter until they are compiled again,
+a generator suspended in evicted code resumes in the interpreter, and code
+that is running is never evicted.
+"""
+import argparse
+import sys
+import unittest
+
+
+def make_function(i):
+    namespace = {}
+    exec(f'def f{i}(n):\n'
+         f'    s = 0\n'
+         f'    for k in range(n):\n'
+         f'        s += k * {i}\n'
+         f'    return s\n', namespace)
+    return namespace[f'f{i}']
+
+
+def expected(i, n):
+    return sum(k * i for k in range(n))
+
+
+def resident_bytes(compyler):
+    stats = compyler.stats()
+    return stats['code_bytes'] + stats['metadata_bytes']
+
+
+def function_bytes(compyler, func):
+    stats = compyler.function_stats(func)
+    return stats['code_bytes'] + stats['metadata_bytes']
+
+
+def counting(n):
+    try:
+        for i in range(n):
+            # i stays on the stack across the yield
+            yield i - (yield i)
+    finally:
+        pass
+
+
+class EvictionTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        import compyler
+        cls.compyler = compyler
+
+    def setUp(self):
+        # start without the code of the other tests
+        self.compyler.set_memory_budget(1)
+        self.compyler.set_memory_budget(0)
+        self.evictions = self.compyler.stats()['evictions']
+
+    def tearDown(self):
+        self.compyler.set_memory_budget(0)
+
+    def compileAll(self, funcs):
+        for func in funcs:
+            self.compyler.apply(func)
+
+    def test_budget(self):
+        funcs = [make_function(i) for i in range(20)]
+        self.compileAll(funcs)
+        budget = resident_bytes(self.compyler) - 5 * function_bytes(self.compyler, funcs[0])
+        self.compyler.set_memory_budget(budget)
+        self.assertLessEqual(resident_bytes(self.compyler), budget)
+        self.assertGreaterEqual(self.compyler.stats()['evictions'] - self.evictions, 5)
+        for i, func in enumerate(funcs):
+            self.assertEqual(func(10), expected(i, 10))
+
+    def test_too_small_budget_fails_compilation(self):
+        self.compyler.set_memory_budget(1)
+        func = make_function(1)
+        with self.assertRaises(MemoryError):
+            self.compyler.apply(func)
+        self.assertIsNone(self.compyler.function_stats(func))
+        self.assertEqual(func(10), expected(1, 10))
+
+    def test_least_recently_executed_first(self):
+        funcs = [make_function(i) for i in range(10)]
+        self.compileAll(funcs)
+        # called in reverse order, so the first ones are the most recent
+        for func in reversed(funcs):
+            func(1)
+        self.compyler.set_memory_budget(sum(function_bytes(self.compyler, func) for func in funcs[:7]))
+        gone = [self.compyler.function_stats(func) is None for func in funcs]
+        self.assertEqual(gone, [False] * 7 + [True] * 3)
+
+    def test_evicted_function_compiles_again(self):
+        func = make_function(3)
+        self.compyler.apply(func)
+        self.compyler.set_memory_budget(1)
+        self.assertIsNone(self.compyler.function_stats(func))
+        self.compyler.set_memory_budget(0)
+        self.compyler.apply(func)
+        self.assertFalse(self.compyler.function_stats(func)['evicted'])
+        self.assertEqual(func(10), expected(3, 10))
+
+    def test_running_code_is_kept(self):
+        compyler = self.compyler
+
+        def outer():
+            compyler.set_memory_budget(1)
+            return compyler.function_stats(outer)
+
+        compyler.apply(outer)
+        stats = outer()
+        self.assertIsNotNone(stats)
+        self.assertFalse(stats['evicted'])
+        # evicted once it has returned
+        compyler.set_memory_budget(1)
+        self.assertIsNone(compyler.function_stats(outer))
+
+    def test_suspended_generator_resumes(self):
+        self.compyler.apply(counting)
+        gen = counting(3)
+        self.assertEqual(next(gen), 0)
+        self.assertEqual(gen.send(10), -10)
+        self.assertEqual(next(gen), 1)
+        self.compyler.set_memory_budget(1)
+        # the generator keeps the tables to resume, not the code
+        self.assertTrue(self.compyler.function_stats(counting)['evicted'])
+        self.assertEqual(gen.send(20), -19)
+        self.assertEqual(next(gen), 2)
+        self.assertEqual(gen.send(5), -3)
+        self.assertEqual(list(gen), [])
+        gen = counting(1)
+        self.assertEqual(next(gen), 0)
+        self.assertEqual(gen.send(4), -4)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--module-dir', help='directory containing the built compyler.so')
+    args, rest = parser.parse_known_args()
+    if args.module_dir:
+        sys.path.insert(0, args.module_dir)
+    unittest.main(argv=[sys.argv[0]] + rest)
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Check that compiled code keeps f_lasti current wherever the frame can be observed.
+
+The line numbers seen in tracebacks and through sys._getframe() come from f_lasti,
+which the compiled code only stores before calls, so each test raises or looks at
+the frame from a callee that is reached in a different way.
+"""
+import argparse
+import inspect
+import sys
+import traceback
+import unittest
+
+
+def line_of(func, marker):
+    lines, first = inspect.getsourcelines(func)
+    return first + next(i for i, line in enumerate(lines) if marker in line)
+
+
+def compiled_frame_line(err, func):
+    return next(f.lineno for f in traceback.extract_tb(err.__traceback__) if f.name == func.__name__)
+
+
+class RaisingIterator:
+    def __init__(self, n):
+        self.n = n
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        if not self.n:
+            raise ValueError('from __next__')
+        self.n -= 1
+        return self.n
+
+
+class CallerLine:
+    def __init__(self, n):
+        self.n = n
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        if not self.n:
+            self.line = sys._getframe(1).f_lineno
+            raise StopIteration
+        self.n -= 1
+        return self.n
+
+
+class RaisingItem:
+    def __getitem__(self, key):
+        raise KeyError(key)
+
+
+class RaisingLength:
+    def __len__(self):
+        raise OverflowError('from __len__')
+
+
+def iterate(it):
+    total = 0
+    total += 1
+    for x in it:  # for
+        # calls a helper on another line, so a missed store leaves f_lasti there
+        total += abs(x)
+    return total
+
+
+def subscript(obj):
+    x = 1
+    y = x + 1
+    return obj[y]  # subscript
+
+
+def length(obj):
+    x = [1, 2]
+    x.append(3)
+    return len(x) + len(obj)  # length
+
+
+class LastiTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        import compyler
+        for func in (iterate, subscript, length):
+            compyler.apply(func)
+
+    def assertRaisesAt(self, exc_type, func, marker, *args):
+        # not assertRaises, which drops the traceback
+        try:
+            func(*args)
+        except exc_type as err:
+            self.assertEqual(compiled_frame_line(err, func), line_of(func, marker))
+        else:
+            self.fail(f'{exc_type.__name__} not raised')
+
+    def test_iterator_next_raises(self):
+        self.assertRaisesAt(ValueError, iterate, '# for', RaisingIterator(3))
+
+    def test_iterator_next_reads_caller_line(self):
+        it = CallerLine(3)
+        self.assertEqual(iterate(it), 4)
+        self.assertEqual(it.line, line_of(iterate, '# for'))
+
+    def test_mapping_slot_raises(self):
+        self.assertRaisesAt(KeyError, subscript, '# subscript', RaisingItem())
+
+    def test_sequence_slot_raises(self):
+        self.assertRaisesAt(OverflowError, length, '# length', RaisingLength())
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--module-dir', help='directory containing the built compyler.so')
+    args, rest = parser.parse_known_args()
+    if args.module_dir:
+        sys.path.insert(0, args.module_dir)
+    unittest.main(argv=[sys.argv[0]] + rest)
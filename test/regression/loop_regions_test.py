@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""Check that a loops_only function runs its later loop nests compiled.
+
+The code after the first loop nest runs in the interpreter, which comes back
+to the compiled code at the FOR_ITER header of each later loop nest. A helper
+called from a loop body sees the function's own code object only when the
+loop runs compiled, the interpreter runs a copy of it.
+"""
+import argparse
+import sys
+import unittest
+
+
+def caller_code():
+    return sys._getframe(1).f_code
+
+
+def hot_second_loop(n, m):
+    s = 0
+    for i in range(n):
+        s += i
+    codes = set()
+    s = str(s)
+    for j in range(m):
+        codes.add(caller_code())
+        s += 'x'
+    return s, codes
+
+
+def while_between_loops(n):
+    for i in range(n):
+        pass
+    codes = set()
+    k = 0
+    while k < n:
+        codes.add(caller_code())
+        k += 1
+    for j in range(n):
+        k += j
+    return k, codes
+
+
+def loop_in_try(n):
+    for i in range(n):
+        pass
+    r = []
+    try:
+        for j in range(n):
+            r.append(caller_code())
+            if j == 2:
+                raise KeyError(j)
+    except KeyError as e:
+        r.append(e.args)
+    return r
+
+
+class Exit:
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.exc_type = exc_info[0]
+        return True
+
+
+def loop_in_with(n):
+    for i in range(n):
+        pass
+    cm = Exit()
+    with cm:
+        for j in range(n):
+            if j == 1:
+                raise ValueError(j)
+    return cm.exc_type
+
+
+def loop_in_except(n):
+    for i in range(n):
+        pass
+    try:
+        raise ValueError
+    except ValueError:
+        r = []
+        for j in range(n):
+            r.append(sys.exc_info()[0])
+    r.append(sys.exc_info()[0])
+    return r
+
+
+def exits_from_loop(n):
+    for i in range(n):
+        pass
+    for j in range(n):
+        if j == 1:
+            continue
+        if j == 3:
+            break
+    for k in range(n):
+        if k == 2:
+            return j, k
+
+
+def raises_in_loop(n):
+    for i in range(n):
+        pass
+    for j in range(n):
+        if j == 2:
+            raise IndexError(j)
+
+
+def generator_loops(n):
+    for i in range(n):
+        yield i
+    for j in range(n):
+        yield caller_code()
+
+
+def tracer(frame, event, arg):
+    return tracer
+
+
+def starts_tracing(n):
+    for i in range(n):
+        pass
+    sys.settrace(tracer)
+    s = 0
+    for j in range(n):
+        s += j
+    return s
+
+
+class LoopRegionsTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        import compyler
+        cls.compyler = compyler
+        for func in (hot_second_loop, while_between_loops, loop_in_try, loop_in_with, loop_in_except,
+                     exits_from_loop, raises_in_loop, generator_loops, starts_tracing):
+            compyler.apply(func, loops_only=True)
+
+    def test_second_loop_runs_compiled(self):
+        exits = self.compyler.stats()['interpreter_exits']
+        s, codes = hot_second_loop(3, 1000)
+        self.assertEqual(s, '3' + 'x' * 1000)
+        self.assertEqual(codes, {hot_second_loop.__code__})
+        # once after each loop nest
+        self.assertEqual(self.compyler.stats()['interpreter_exits'] - exits, 2)
+
+    def test_while_loop_is_interpreted(self):
+        k, codes = while_between_loops(3)
+        self.assertEqual(k, 6)
+        self.assertEqual(len(codes), 1)
+        self.assertIsNot(codes.pop(), while_between_loops.__code__)
+
+    def test_try_set_up_by_interpreter(self):
+        code = loop_in_try.__code__
+        self.assertEqual(loop_in_try(5), [code, code, code, (2,)])
+        self.assertIs(loop_in_with(3), ValueError)
+
+    def test_loop_in_except_handler(self):
+        self.assertEqual(loop_in_except(2), [ValueError] * 2 + [None])
+
+    def test_exits_from_loop(self):
+        self.assertEqual(exits_from_loop(5), (3, 2))
+        self.assertIsNone(exits_from_loop(2))
+
+    def test_traceback(self):
+        try:
+            raises_in_loop(5)
+        except IndexError as e:
+            tb = e.__traceback__.tb_next
+        else:
+            self.fail('no IndexError')
+        self.assertIs(tb.tb_frame.f_code, raises_in_loop.__code__)
+        self.assertEqual(tb.tb_lineno, raises_in_loop.__code__.co_firstlineno + 5)
+
+    def test_generator_stays_in_interpreter(self):
+        values = list(generator_loops(2))
+        self.assertEqual(values[:2], [0, 1])
+        self.assertEqual(values[2:], [generator_loops.__code__] * 2)
+
+    def test_tracing_started_before_loop(self):
+        try:
+            self.assertEqual(starts_tracing(5), 10)
+        finally:
+            sys.settrace(None)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--module-dir', help='directory containing the built compyler.so')
+    args, rest = parser.parse_known_args()
+    if args.module_dir:
+        sys.path.insert(0, args.module_dir)
+    unittest.main(argv=[sys.argv[0]] + rest)
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Check that a generator suspended in compiled code can be resumed by the interpreter.
+
+While tracing is on, a frame that was suspended at a yield of the compiled code
+continues in the interpreter, which takes the value stack of the frame as it is.
+Each generator here keeps a value on the stack across the yield that the
+compiled code could otherwise leave out of the frame or leave unformatted.
+"""
+import argparse
+import sys
+import unittest
+
+
+# b is the last local, which is what a read below the value stack would see
+def local_below_yield(a, b):
+    yield a - (yield)
+
+
+def const_below_yield(b):
+    yield 100 - (yield)
+
+
+def format_below_yield(n):
+    yield f'{n}:{(yield)}'
+
+
+def float_format_below_yield(x):
+    yield f'{x}{x}-{(yield)}'
+
+
+def two_then_three():
+    yield 1
+    yield 2
+    return 3
+
+
+def delegate_below_yield(a, b):
+    yield a - (yield from two_then_three())
+
+
+def tracer(frame, event, arg):
+    return tracer
+
+
+class SuspendTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        import compyler
+        for func in (local_below_yield, const_below_yield, format_below_yield,
+                     float_format_below_yield, delegate_below_yield):
+            compyler.apply(func)
+
+    def resumeTraced(self, gen, first, sent):
+        # started in the compiled code, resumed by the interpreter
+        self.assertEqual(next(gen), first)
+        sys.settrace(tracer)
+        try:
+            return gen.send(sent)
+        finally:
+            sys.settrace(None)
+
+    def resumeUntraced(self, func, args, first, sent):
+        gen = func(*args)
+        self.assertEqual(next(gen), first)
+        return gen.send(sent)
+
+    def test_borrowed_local(self):
+        self.assertEqual(self.resumeTraced(local_below_yield(10, 1000), None, 3), 7)
+
+    def test_borrowed_const(self):
+        self.assertEqual(self.resumeTraced(const_below_yield(1000), None, 3), 97)
+
+    def test_deferred_int_format(self):
+        self.assertEqual(self.resumeTraced(format_below_yield(42), None, 'sent'), '42:sent')
+
+    def test_deferred_float_format(self):
+        self.assertEqual(self.resumeTraced(float_format_below_yield(0.5), None, 'x'), '0.50.5-x')
+
+    def test_yield_from(self):
+        gen = delegate_below_yield(10, 1000)
+        self.assertEqual(next(gen), 1)
+        sys.settrace(tracer)
+        try:
+            self.assertEqual(gen.send(None), 2)
+            self.assertEqual(gen.send(None), 7)
+        finally:
+            sys.settrace(None)
+
+    def test_untraced(self):
+        self.assertEqual(self.resumeUntraced(local_below_yield, (10, 1000), None, 3), 7)
+        self.assertEqual(self.resumeUntraced(format_below_yield, (42,), None, 'sent'), '42:sent')
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--module-dir', help='directory containing the built compyler.so')
+    args, rest = parser.parse_known_args()
+    if args.module_dir:
+        sys.path.insert(0, args.module_dir)
+    unittest.main(argv=[sys.argv[0]] + rest)
@@ -109,6 +109,8 @@ Context::Context(const DataLayout &dl) :
     tbaa_frame_value = createTBAA("frame value");
     tbaa_code_const = createTBAA("code const", true);
     tbaa_symbols = createTBAA("symbols", true);
+    tbaa_counter = createTBAA("counter");
+    tbaa_allocator = createTBAA("allocator state");
 
     auto attr_builder = AttrBuilder(llvm_context);
     attr_builder
@@ -116,15 +118,21 @@ Context::Context(const DataLayout &dl) :
             .addAttribute(Attribute::NoReturn);
     attr_noreturn = AttributeList::get(llvm_context, AttributeList::FunctionIndex, attr_builder);
     attr_builder.clear();
+    // a deallocator may run __del__, and the helpers may raise or run any Python code,
+    // both of which read the frame through tstate->frame, so neither is limited to its arguments
     attr_builder
             .addAttribute(Attribute::NoUnwind)
-            .addAttribute(Attribute::WillReturn)
-            .addAttribute(Attribute::ArgMemOnly);
+            .addAttribute(Attribute::WillReturn);
     attr_refcnt_call = AttributeList::get(llvm_context, AttributeList::FunctionIndex, attr_builder);
     attr_builder.clear();
     attr_builder
             .addAttribute(Attribute::NoUnwind)
-            .addAttribute("tune-cpu", sys::getHostCPUName())
-            .addAttribute(Attribute::InaccessibleMemOrArgMemOnly);
+            .addAttribute("tune-cpu", sys::getHostCPUName());
     attr_default_call = AttributeList::get(llvm_context, AttributeList::FunctionIndex, attr_builder);
+    attr_builder.clear();
+    attr_builder
+            .addAttribute(Attribute::NoUnwind)
+            .addAttribute(Attribute::WillReturn)
+            .addAttribute(Attribute::InaccessibleMemOrArgMemOnly);
+    attr_frameless_call = AttributeList::get(llvm_context, AttributeList::FunctionIndex, attr_builder);
 }
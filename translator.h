@@ -60,9 +60,13 @@ public:
     llvm::MDNode *tbaa_frame_value;
     llvm::MDNode *tbaa_code_const;
     llvm::MDNode *tbaa_symbols;
+    llvm::MDNode *tbaa_counter;
+    llvm::MDNode *tbaa_allocator;
     llvm::AttributeList attr_refcnt_call;
     llvm::AttributeList attr_noreturn;
     llvm::AttributeList attr_default_call;
+    // for the helpers which neither raise nor run Python code
+    llvm::AttributeList attr_frameless_call;
 
     explicit Context(const llvm::DataLayout &dl);
 
@@ -75,6 +79,9 @@ public:
 
 class Translator : public Compiler, public Context {
 public:
+    // analysis and IR building data of the current compilation
+    BumpArena arena;
+
     Translator() : Compiler{}, Context{machine->createDataLayout()} {}
 };
 